@@ -7,6 +7,7 @@
 #include <string.h>
 #include <gio/gio.h>
 #include <math.h>
+#include <unistd.h>
 
 // #define LOG(msg, ...) fprintf(stderr, "[ndfr-helper-log] " msg "\n", ##__VA_ARGS__)
 #define LOG(msg, ...)
@@ -246,38 +247,556 @@ static int handle_set_position_percent(GDBusConnection *bus, const char *player_
 }
 
 // --- 'listen' command implementation ---
+//
+// The player set is built once at startup and then kept current from bus signals:
+// NameOwnerChanged adds and removes players, PropertiesChanged and Seeked update them.
+// Nothing is sent over D-Bus while the players are idle.
+//
+// "position" is a sample taken at "timestamp" (CLOCK_MONOTONIC usecs); readers extrapolate
+// it with "rate" while the player is Playing, so nothing is emitted while a track just plays.
+
+#define MPRIS_PREFIX "org.mpris.MediaPlayer2."
+#define MPRIS_PATH "/org/mpris/MediaPlayer2"
+#define MPRIS_PLAYER_IFACE "org.mpris.MediaPlayer2.Player"
+
+typedef struct {
+    gchar *name;          // well-known name, e.g. org.mpris.MediaPlayer2.spotify
+    gchar *owner;         // unique name the player's signals are sent from
+    gchar *status;
+    gchar *title;
+    gchar *artist;
+    gint64 length;
+    gint64 position;      // usecs, sampled at position_time
+    gint64 position_time; // g_get_monotonic_time() of the sample
+    gdouble rate;
+} ListenPlayer;
+
+typedef struct {
+    GDBusConnection *bus;
+    GPtrArray *players; // ListenPlayer*, in discovery order
+    gchar *previous_json;
+} ListenState;
+
+static void listen_player_free(gpointer data) {
+    ListenPlayer *player = data;
+    g_free(player->name);
+    g_free(player->owner);
+    g_free(player->status);
+    g_free(player->title);
+    g_free(player->artist);
+    g_free(player);
+}
+
+static ListenPlayer* listen_find_player(ListenState *state, const gchar *owner, const gchar *name) {
+    for (guint i = 0; i < state->players->len; i++) {
+        ListenPlayer *player = g_ptr_array_index(state->players, i);
+        if ((owner && g_strcmp0(player->owner, owner) == 0) || (name && g_strcmp0(player->name, name) == 0)) {
+            return player;
+        }
+    }
+    return NULL;
+}
+
+static gint64 variant_get_usecs(GVariant *value) {
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+        return g_variant_get_int64(value);
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT64)) {
+        return (gint64)g_variant_get_uint64(value);
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT32)) {
+        return g_variant_get_int32(value);
+    }
+    return 0;
+}
+
+static gint64 listen_current_position(const ListenPlayer *player, gint64 now) {
+    gint64 position = player->position;
+    if (g_strcmp0(player->status, "Playing") == 0) {
+        position += (gint64)((double)(now - player->position_time) * player->rate);
+    }
+    if (player->length > 0 && position > player->length) {
+        position = player->length;
+    }
+    return position < 0 ? 0 : position;
+}
+
+static void listen_set_position(ListenPlayer *player, gint64 position) {
+    player->position = position;
+    player->position_time = g_get_monotonic_time();
+}
+
+static void listen_apply_metadata(ListenPlayer *player, GVariant *metadata) {
+    GVariantIter iter;
+    gchar *key;
+    GVariant *value;
+
+    g_clear_pointer(&player->title, g_free);
+    g_clear_pointer(&player->artist, g_free);
+    player->length = 0;
+
+    g_variant_iter_init(&iter, metadata);
+    while (g_variant_iter_next(&iter, "{sv}", &key, &value)) {
+        if (strcmp(key, "mpris:length") == 0) {
+            player->length = variant_get_usecs(value);
+        } else if (strcmp(key, "xesam:title") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+            player->title = g_variant_dup_string(value, NULL);
+        } else if (strcmp(key, "xesam:artist") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE("as"))) {
+            const gchar **artists = g_variant_get_strv(value, NULL);
+            if (artists && artists[0]) {
+                player->artist = g_strdup(artists[0]);
+            }
+            g_free(artists); // only the container is ours, the strings belong to `value`
+        }
+        g_free(key);
+        g_variant_unref(value);
+    }
+}
+
+// Applies an a{sv} of player properties. Returns TRUE if the position has to be re-read,
+// which is the case after a track or status change since MPRIS does not signal Position.
+static gboolean listen_apply_properties(ListenPlayer *player, GVariant *properties) {
+    GVariantIter iter;
+    gchar *key;
+    GVariant *value;
+    gboolean needs_position = FALSE;
+    gboolean has_position = FALSE;
+
+    g_variant_iter_init(&iter, properties);
+    while (g_variant_iter_next(&iter, "{sv}", &key, &value)) {
+        if (strcmp(key, "PlaybackStatus") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+            const gchar *status = g_variant_get_string(value, NULL);
+            if (g_strcmp0(player->status, status) != 0) {
+                // freeze the extrapolated position before the status changes under it
+                listen_set_position(player, listen_current_position(player, g_get_monotonic_time()));
+                g_free(player->status);
+                player->status = g_strdup(status);
+                needs_position = TRUE;
+            }
+        } else if (strcmp(key, "Metadata") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_VARDICT)) {
+            listen_apply_metadata(player, value);
+            needs_position = TRUE;
+        } else if (strcmp(key, "Position") == 0) {
+            listen_set_position(player, variant_get_usecs(value));
+            has_position = TRUE;
+        } else if (strcmp(key, "Rate") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+            listen_set_position(player, listen_current_position(player, g_get_monotonic_time()));
+            player->rate = g_variant_get_double(value);
+        }
+        g_free(key);
+        g_variant_unref(value);
+    }
+    return needs_position && !has_position;
+}
+
+static void listen_refresh_position(ListenState *state, ListenPlayer *player) {
+    GVariant *reply = g_dbus_connection_call_sync(state->bus, player->owner, MPRIS_PATH,
+                                                  "org.freedesktop.DBus.Properties", "Get",
+                                                  g_variant_new("(ss)", MPRIS_PLAYER_IFACE, "Position"),
+                                                  G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (!reply) {
+        LOG("Could not read Position of %s", player->name);
+        return;
+    }
+    GVariant *value;
+    g_variant_get(reply, "(v)", &value);
+    listen_set_position(player, variant_get_usecs(value));
+    g_variant_unref(value);
+    g_variant_unref(reply);
+}
+
+static void listen_refresh_player(ListenState *state, ListenPlayer *player) {
+    GVariant *reply = g_dbus_connection_call_sync(state->bus, player->owner, MPRIS_PATH,
+                                                  "org.freedesktop.DBus.Properties", "GetAll",
+                                                  g_variant_new("(s)", MPRIS_PLAYER_IFACE),
+                                                  G_VARIANT_TYPE("(a{sv})"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (!reply) {
+        LOG("Could not read properties of %s", player->name);
+        return;
+    }
+    GVariant *properties = g_variant_get_child_value(reply, 0);
+    if (listen_apply_properties(player, properties)) {
+        listen_refresh_position(state, player);
+    }
+    g_variant_unref(properties);
+    g_variant_unref(reply);
+}
 
-static gboolean high_frequency_poll(gpointer user_data) {
-    static gchar *previous_json = NULL;
-    GDBusConnection *bus = (GDBusConnection *)user_data;
+static void listen_add_player(ListenState *state, const gchar *name, const gchar *owner) {
+    if (listen_find_player(state, NULL, name)) {
+        return;
+    }
+    LOG("Player appeared: %s (%s)", name, owner);
+    ListenPlayer *player = g_new0(ListenPlayer, 1);
+    player->name = g_strdup(name);
+    player->owner = g_strdup(owner);
+    player->rate = 1.0;
+    player->position_time = g_get_monotonic_time();
+    g_ptr_array_add(state->players, player);
+    listen_refresh_player(state, player);
+}
 
-    gchar *current_json = get_players_json(bus);
+static void listen_append_json_string(GString *json, const gchar *str) {
+    g_string_append_c(json, '"');
+    for (const gchar *p = str ? str : ""; *p; p++) {
+        switch (*p) {
+            case '"': g_string_append(json, "\\\""); break;
+            case '\\': g_string_append(json, "\\\\"); break;
+            case '\n': g_string_append(json, "\\n"); break;
+            case '\r': g_string_append(json, "\\r"); break;
+            case '\t': g_string_append(json, "\\t"); break;
+            default:
+                if ((guchar)*p < 0x20) {
+                    g_string_append_printf(json, "\\u%04x", (guchar)*p);
+                } else {
+                    g_string_append_c(json, *p);
+                }
+        }
+    }
+    g_string_append_c(json, '"');
+}
 
-    if (previous_json == NULL || g_strcmp0(previous_json, current_json) != 0) {
-        LOG("State changed. New JSON: %s", current_json);
-        printf("%s\n", current_json);
+static void listen_append_player_json(GString *json, const ListenPlayer *player) {
+    const gchar *icon_name = g_str_has_prefix(player->name, MPRIS_PREFIX) ? player->name + strlen(MPRIS_PREFIX) : "";
+    if (json->len > 1) {
+        g_string_append_c(json, ',');
+    }
+    g_string_append(json, "{\"player_id\":");
+    listen_append_json_string(json, player->name);
+    g_string_append(json, ",\"status\":");
+    listen_append_json_string(json, player->status);
+    g_string_append_printf(json, ",\"position\":%lld,\"timestamp\":%lld,\"rate\":%g,\"length\":%lld,\"title\":",
+                           (long long)player->position, (long long)player->position_time, player->rate,
+                           (long long)player->length);
+    listen_append_json_string(json, player->title);
+    g_string_append(json, ",\"artist\":");
+    listen_append_json_string(json, player->artist);
+    g_string_append(json, ",\"icon\":");
+    listen_append_json_string(json, icon_name);
+    g_string_append_c(json, '}');
+}
+
+// Same ordering and filtering as `get`: playing players first, then paused ones.
+static void listen_emit(ListenState *state) {
+    GString *json = g_string_new("[");
+
+    for (guint i = 0; i < state->players->len; i++) {
+        ListenPlayer *player = g_ptr_array_index(state->players, i);
+        if (g_strcmp0(player->status, "Playing") == 0) {
+            listen_append_player_json(json, player);
+        }
+    }
+    for (guint i = 0; i < state->players->len; i++) {
+        ListenPlayer *player = g_ptr_array_index(state->players, i);
+        if (g_strcmp0(player->status, "Paused") == 0) {
+            listen_append_player_json(json, player);
+        }
+    }
+    g_string_append_c(json, ']');
+
+    if (state->previous_json == NULL || g_strcmp0(state->previous_json, json->str) != 0) {
+        LOG("State changed. New JSON: %s", json->str);
+        printf("%s\n", json->str);
         fflush(stdout);
-        
-        g_free(previous_json);
-        previous_json = current_json; // previous_json now owns the memory of current_json
+        g_free(state->previous_json);
+        state->previous_json = g_string_free(json, FALSE);
     } else {
-        g_free(current_json);
+        g_string_free(json, TRUE);
     }
+}
 
-    return G_SOURCE_CONTINUE;
+static void on_name_owner_changed(GDBusConnection *bus, const gchar *sender, const gchar *path,
+                                  const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
+    ListenState *state = user_data;
+    const gchar *name, *old_owner, *new_owner;
+    g_variant_get(params, "(&s&s&s)", &name, &old_owner, &new_owner);
+    if (!g_str_has_prefix(name, MPRIS_PREFIX)) {
+        return;
+    }
+
+    ListenPlayer *player = listen_find_player(state, NULL, name);
+    if (player) {
+        LOG("Player vanished: %s", name);
+        g_ptr_array_remove(state->players, player);
+    }
+    if (*new_owner) {
+        listen_add_player(state, name, new_owner);
+    }
+    listen_emit(state);
 }
 
-static int handle_listen(GDBusConnection *bus) {
-    LOG("Handling 'listen' command using high-frequency polling");
-    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+static void on_properties_changed(GDBusConnection *bus, const gchar *sender, const gchar *path,
+                                  const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
+    ListenState *state = user_data;
+    ListenPlayer *player = listen_find_player(state, sender, NULL);
+    if (!player) {
+        return;
+    }
+
+    const gchar *changed_iface;
+    GVariant *changed;
+    const gchar **invalidated;
+    g_variant_get(params, "(&s@a{sv}^a&s)", &changed_iface, &changed, &invalidated);
 
-    g_timeout_add(200, high_frequency_poll, bus);
+    if (invalidated && invalidated[0]) {
+        // some players only invalidate and expect a re-read
+        listen_refresh_player(state, player);
+    } else if (listen_apply_properties(player, changed)) {
+        listen_refresh_position(state, player);
+    }
+
+    g_free(invalidated);
+    g_variant_unref(changed);
+    listen_emit(state);
+}
+
+static void on_seeked(GDBusConnection *bus, const gchar *sender, const gchar *path,
+                      const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
+    ListenState *state = user_data;
+    ListenPlayer *player = listen_find_player(state, sender, NULL);
+    if (!player) {
+        return;
+    }
+    gint64 position;
+    g_variant_get(params, "(x)", &position);
+    listen_set_position(player, position);
+    listen_emit(state);
+}
+
+static void listen_discover_players(ListenState *state) {
+    GVariant *reply = g_dbus_connection_call_sync(state->bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                                  "org.freedesktop.DBus", "ListNames", NULL, G_VARIANT_TYPE("(as)"),
+                                                  G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (!reply) {
+        LOG("Error listing D-Bus names");
+        return;
+    }
 
-    LOG("Starting GMainLoop for polling...");
+    gchar **names;
+    g_variant_get(reply, "(^as)", &names);
+    g_variant_unref(reply);
+
+    for (int i = 0; names[i]; i++) {
+        if (!g_str_has_prefix(names[i], MPRIS_PREFIX)) {
+            continue;
+        }
+        GVariant *owner_reply = g_dbus_connection_call_sync(state->bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                                            "org.freedesktop.DBus", "GetNameOwner",
+                                                            g_variant_new("(s)", names[i]), G_VARIANT_TYPE("(s)"),
+                                                            G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+        if (!owner_reply) {
+            continue;
+        }
+        const gchar *owner;
+        g_variant_get(owner_reply, "(&s)", &owner);
+        listen_add_player(state, names[i], owner);
+        g_variant_unref(owner_reply);
+    }
+    g_strfreev(names);
+}
+
+static int handle_listen(GDBusConnection *bus) {
+    LOG("Handling 'listen' command using bus signals");
+    ListenState state = {
+        .bus = bus,
+        .players = g_ptr_array_new_with_free_func(listen_player_free),
+        .previous_json = NULL,
+    };
+
+    // subscribe before discovery so no player can slip through in between
+    g_dbus_connection_signal_subscribe(bus, "org.freedesktop.DBus", "org.freedesktop.DBus", "NameOwnerChanged",
+                                       "/org/freedesktop/DBus", "org.mpris.MediaPlayer2",
+                                       G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE, on_name_owner_changed, &state, NULL);
+    g_dbus_connection_signal_subscribe(bus, NULL, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                       MPRIS_PATH, MPRIS_PLAYER_IFACE, G_DBUS_SIGNAL_FLAGS_NONE,
+                                       on_properties_changed, &state, NULL);
+    g_dbus_connection_signal_subscribe(bus, NULL, MPRIS_PLAYER_IFACE, "Seeked", MPRIS_PATH, NULL,
+                                       G_DBUS_SIGNAL_FLAGS_NONE, on_seeked, &state, NULL);
+
+    listen_discover_players(&state);
+    listen_emit(&state);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    LOG("Starting GMainLoop for signals...");
     g_main_loop_run(loop);
 
     LOG("GMainLoop finished");
     g_main_loop_unref(loop);
+    g_ptr_array_free(state.players, TRUE);
+    g_free(state.previous_json);
+    return 0;
+}
+
+// --- 'serve' command implementation ---
+//
+// Keeps one bus connection and one proxy per player open and reads commands from stdin,
+// one per line, answering each with "ok" or "error":
+//   play-pause <player_id>
+//   seek <player_id> <offset usecs>
+//   set-position <player_id> <usecs>
+//   set-position-percent <player_id> <%>
+
+typedef struct {
+    GDBusConnection *bus;
+    GHashTable *proxies; // player_id -> GDBusProxy*
+    GMainLoop *loop;
+} ServeState;
+
+static GDBusProxy* serve_get_proxy(ServeState *state, const char *player_id) {
+    GDBusProxy *proxy = g_hash_table_lookup(state->proxies, player_id);
+    if (proxy) {
+        return proxy;
+    }
+    GError *error = NULL;
+    // the proxy keeps Metadata and CanSeek current from PropertiesChanged for as long as we run
+    proxy = g_dbus_proxy_new_sync(state->bus, G_DBUS_PROXY_FLAGS_NONE, NULL, player_id, MPRIS_PATH,
+                                  MPRIS_PLAYER_IFACE, NULL, &error);
+    if (error) {
+        LOG("Error creating proxy for %s: %s", player_id, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    g_hash_table_insert(state->proxies, g_strdup(player_id), proxy);
+    return proxy;
+}
+
+static gboolean serve_call(GDBusProxy *proxy, const gchar *method, GVariant *params) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_proxy_call_sync(proxy, method, params, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    if (error) {
+        LOG("%s failed: %s", method, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    g_variant_unref(reply);
+    return TRUE;
+}
+
+static gboolean serve_can_seek(GDBusProxy *proxy) {
+    GVariant *can_seek = g_dbus_proxy_get_cached_property(proxy, "CanSeek");
+    gboolean result = can_seek && g_variant_get_boolean(can_seek);
+    if (can_seek) g_variant_unref(can_seek);
+    return result;
+}
+
+static gboolean serve_set_position(GDBusProxy *proxy, gint64 position) {
+    if (!serve_can_seek(proxy)) {
+        return FALSE;
+    }
+    GVariant *metadata = g_dbus_proxy_get_cached_property(proxy, "Metadata");
+    GVariant *track_id = metadata ? g_variant_lookup_value(metadata, "mpris:trackid", NULL) : NULL;
+    if (metadata) g_variant_unref(metadata);
+
+    // SetPosition is absolute and needs no Position read first, so the seek is one round-trip
+    if (track_id && (g_variant_is_of_type(track_id, G_VARIANT_TYPE_OBJECT_PATH) ||
+                     (g_variant_is_of_type(track_id, G_VARIANT_TYPE_STRING) &&
+                      g_variant_is_object_path(g_variant_get_string(track_id, NULL))))) {
+        gboolean result = serve_call(proxy, "SetPosition",
+                                     g_variant_new("(ox)", g_variant_get_string(track_id, NULL), position));
+        g_variant_unref(track_id);
+        return result;
+    }
+    if (track_id) g_variant_unref(track_id);
+
+    // players without track ids only support relative seeks
+    GVariant *reply = g_dbus_connection_call_sync(g_dbus_proxy_get_connection(proxy), g_dbus_proxy_get_name(proxy),
+                                                  MPRIS_PATH, "org.freedesktop.DBus.Properties", "Get",
+                                                  g_variant_new("(ss)", MPRIS_PLAYER_IFACE, "Position"),
+                                                  G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (!reply) {
+        return FALSE;
+    }
+    GVariant *current;
+    g_variant_get(reply, "(v)", &current);
+    gint64 offset = position - variant_get_usecs(current);
+    g_variant_unref(current);
+    g_variant_unref(reply);
+    return serve_call(proxy, "Seek", g_variant_new("(x)", offset));
+}
+
+static gboolean serve_set_position_percent(GDBusProxy *proxy, double percentage) {
+    if (percentage < 0.0 || percentage > 100.0) {
+        return FALSE;
+    }
+    GVariant *metadata = g_dbus_proxy_get_cached_property(proxy, "Metadata");
+    GVariant *length = metadata ? g_variant_lookup_value(metadata, "mpris:length", NULL) : NULL;
+    if (metadata) g_variant_unref(metadata);
+    if (!length) {
+        return FALSE;
+    }
+    gint64 track_length = variant_get_usecs(length);
+    g_variant_unref(length);
+    if (track_length <= 0) {
+        return FALSE;
+    }
+    return serve_set_position(proxy, (gint64)((percentage / 100.0) * (double)track_length));
+}
+
+static gboolean serve_handle_line(ServeState *state, const gchar *line) {
+    gchar **args = g_strsplit(line, " ", 3);
+    guint argc = g_strv_length(args);
+    gboolean result = FALSE;
+
+    GDBusProxy *proxy = argc > 1 ? serve_get_proxy(state, args[1]) : NULL;
+    if (!proxy) {
+        LOG("serve: missing or unknown player in '%s'", line);
+    } else if (strcmp(args[0], "play-pause") == 0) {
+        result = serve_call(proxy, "PlayPause", NULL);
+    } else if (argc < 3) {
+        LOG("serve: missing argument in '%s'", line);
+    } else if (strcmp(args[0], "seek") == 0) {
+        result = serve_can_seek(proxy) && serve_call(proxy, "Seek", g_variant_new("(x)", (gint64)atoll(args[2])));
+    } else if (strcmp(args[0], "set-position") == 0) {
+        result = serve_set_position(proxy, atoll(args[2]));
+    } else if (strcmp(args[0], "set-position-percent") == 0) {
+        result = serve_set_position_percent(proxy, atof(args[2]));
+    } else {
+        LOG("serve: unknown command '%s'", args[0]);
+    }
+
+    g_strfreev(args);
+    return result;
+}
+
+static gboolean on_serve_input(GIOChannel *channel, GIOCondition condition, gpointer user_data) {
+    ServeState *state = user_data;
+    gchar *line = NULL;
+    gsize terminator;
+
+    GIOStatus status = g_io_channel_read_line(channel, &line, NULL, &terminator, NULL);
+    if (status == G_IO_STATUS_NORMAL && line) {
+        line[terminator] = '\0';
+        if (*line) {
+            printf("%s\n", serve_handle_line(state, line) ? "ok" : "error");
+            fflush(stdout);
+        }
+        g_free(line);
+        return G_SOURCE_CONTINUE;
+    }
+    g_free(line);
+    if (status == G_IO_STATUS_AGAIN) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    LOG("serve: stdin closed, exiting");
+    g_main_loop_quit(state->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static int handle_serve(GDBusConnection *bus) {
+    LOG("Handling 'serve' command on stdin");
+    ServeState state = {
+        .bus = bus,
+        .proxies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref),
+        .loop = g_main_loop_new(NULL, FALSE),
+    };
+
+    GIOChannel *channel = g_io_channel_unix_new(STDIN_FILENO);
+    g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR, on_serve_input, &state);
+
+    g_main_loop_run(state.loop);
+
+    g_io_channel_unref(channel);
+    g_main_loop_unref(state.loop);
+    g_hash_table_destroy(state.proxies);
     return 0;
 }
 
@@ -285,7 +804,7 @@ int main(int argc, char *argv[]) {
     LOG("ndfr-media-helper started with %d args", argc);
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <command> [player_id] [args...]\n", argv[0]);
-        fprintf(stderr, "Commands:\n  get\n  listen\n  play-pause [player_id]\n  set-position [player_id] <usecs>\n  set-position-percent [player_id] <%%>\n");
+        fprintf(stderr, "Commands:\n  get\n  listen\n  serve\n  play-pause [player_id]\n  set-position [player_id] <usecs>\n  set-position-percent [player_id] <%%>\n");
         return 1;
     }
     GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
@@ -301,6 +820,8 @@ int main(int argc, char *argv[]) {
         result = handle_get(bus);
     } else if (strcmp(command, "listen") == 0) {
         result = handle_listen(bus);
+    } else if (strcmp(command, "serve") == 0) {
+        result = handle_serve(bus);
     } else if (strcmp(command, "play-pause") == 0) {
         const char *player = NULL;
         GList *players = NULL;
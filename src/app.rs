@@ -1,19 +1,24 @@
-use crate::ui::{Page, Button, create_default_layout, create_fn_layout, create_brightness_slider_layout, create_volume_slider_layout, create_expanded_layout};
+use crate::ui::{Page, Button, LayoutCompiler, LayoutVariant, create_fn_layout, create_brightness_slider_layout, create_volume_slider_layout, create_expanded_layout};
 use crate::input::{InputEvent, TouchEvent};
 use crate::virtual_keyboard;
 use crate::screenshot;
 use crate::dynamic::{DynamicDrawable, DynamicManager, Rect};
 use crate::media::MediaInfo;
+use crate::latency::InputTrace;
+use crate::mpris::MediaController;
+use crate::reload::ReloadedLayouts;
 use anyhow::Result;
 use evdev::Key as EvdevKey;
 use input_linux::Key as UinputKey;
 use input_linux::uinput::UInputHandle;
-use std::env;
 use std::fs::File;
-use std::process::Command;
+use std::sync::mpsc::Sender;
 use std::sync::Arc;
 use std::sync::Mutex;
-use std::time::Instant;
+use std::time::{Duration, Instant};
+
+const CONTROL_STRIP_TIMEOUT: Duration = Duration::from_secs(5);
+const ANIMATION_DURATION: Duration = Duration::from_millis(350);
 
 #[derive(Clone, Debug, PartialEq)]
 pub enum Gesture {
@@ -23,6 +28,64 @@ pub enum Gesture {
     ScrubberDrag { player_id: String },
 }
 
+// Everything the main loop reacts to.
+#[derive(Debug)]
+pub enum AppEvent {
+    // with the kernel's timestamp for the event
+    Input(InputEvent, Instant),
+    MediaChanged,
+    ClockTick,
+    BrightnessChanged(f64),
+    VolumeChanged(f64),
+    LayoutsReloaded(ReloadedLayouts),
+    LayoutVariantBuilt(LayoutVariant),
+}
+
+// Everything the render thread needs for a frame, copied out of AppState so the two
+// threads never share it.
+pub struct RenderSnapshot {
+    pub page: Page,
+    pub gesture: Gesture,
+    pub dynamic_content: Option<(DynamicDrawable, Rect)>,
+    // the earliest input this snapshot is the first to show
+    pub input: Option<InputTrace>,
+    animation_start: Instant,
+    is_animating: bool,
+}
+
+impl RenderSnapshot {
+    pub fn animation_progress(&self, now: Instant) -> f64 {
+        animation_progress(&self.page, self.is_animating, self.animation_start, now)
+    }
+
+    // Whether frames still need drawing without a new snapshot arriving.
+    pub fn is_animating(&self, now: Instant) -> bool {
+        self.is_animating && now.saturating_duration_since(self.animation_start) < ANIMATION_DURATION
+    }
+}
+
+fn animation_progress(page: &Page, is_animating: bool, animation_start: Instant, now: Instant) -> f64 {
+    if !is_animating {
+        return 1.0;
+    }
+
+    let elapsed = now.saturating_duration_since(animation_start).as_millis() as f64;
+    let duration = ANIMATION_DURATION.as_millis() as f64;
+    let t = (elapsed / duration).min(1.0);
+
+    let ease_in_out_quad = |t: f64| {
+        if t < 0.5 { 2.0 * t * t } else { -1.0 + (4.0 - 2.0 * t) * t }
+    };
+
+    match page {
+        Page::BrightnessSlider(_) | Page::VolumeSlider(_) | Page::ControlStripExpanding(_) | Page::MediaInfoShowing(_) => ease_in_out_quad(t),
+        Page::BrightnessSliderClosing(_) | Page::VolumeSliderClosing(_) | Page::ControlStripClosing(_) | Page::MediaInfoHiding(_) => 1.0 - ease_in_out_quad(t),
+        _ => 1.0,
+    }
+}
+
+// Methods that depend on time take `now` instead of reading the clock, so a replay can
+// drive the state with recorded timestamps.
 pub struct AppState {
     pub page: Page,
     pub brightness_value: f64,
@@ -34,6 +97,11 @@ pub struct AppState {
     pub last_input_time: Instant,
     pub last_volume_update: Instant,
     pub default_layout: Arc<Vec<Button>>,
+    layouts: LayoutCompiler,
+    // where new default layout variants are built; None builds them inline
+    layout_tx: Option<Sender<AppEvent>>,
+    // the default layout was built from layouts that have since been replaced
+    default_layout_stale: bool,
     pub fn_layout: Arc<Vec<Button>>,
     pub expanded_layout: Arc<Vec<Button>>,
     pub control_strip_expanded: bool,
@@ -51,10 +119,10 @@ pub struct AppState {
 }
 
 impl AppState {
-    pub fn new(width: i32, height: i32, has_physical_esc: bool, media_info: &Vec<MediaInfo>) -> Result<Self> {
-        println!("[ndfr] Initializing new state");
-        let (default_buttons, default_dynamic_area_bounds) = create_default_layout(width, height, has_physical_esc, media_info)?;
-        let default_layout = Arc::new(default_buttons);
+    pub fn new(width: i32, height: i32, has_physical_esc: bool, media_info: &Vec<MediaInfo>, now: Instant) -> Result<Self> {
+        log_info!("[ndfr] Initializing new state");
+        let mut layouts = LayoutCompiler::new(width, height, has_physical_esc)?;
+        let (default_layout, default_dynamic_area_bounds) = layouts.default_layout(media_info)?;
         let fn_layout = Arc::new(create_fn_layout(width, height)?);
         let expanded_layout = Arc::new(create_expanded_layout(width, height)?);
         Ok(AppState {
@@ -62,12 +130,15 @@ impl AppState {
            brightness_value: 0.5,
            volume_value: 0.5,
            gesture: Gesture::Idle,
-           animation_start: Instant::now(),
+           animation_start: now,
            needs_redraw: true,
            is_animating: false,
-           last_input_time: Instant::now(),
-           last_volume_update: Instant::now(),
+           last_input_time: now,
+           last_volume_update: now,
            default_layout,
+           layouts,
+           layout_tx: None,
+           default_layout_stale: false,
            fn_layout,
            expanded_layout,
            control_strip_expanded: false,
@@ -85,12 +156,151 @@ impl AppState {
         })
     }
 
-    pub fn handle_event(&mut self, event: InputEvent, uinput: &mut UInputHandle<File>, latest_media_info: &Arc<Mutex<Vec<MediaInfo>>>) -> Result<()> {
+    // Builds layout variants for new player icons off this thread from now on; they
+    // arrive as AppEvent::LayoutVariantBuilt.
+    pub fn build_layouts_in_background(&mut self, tx: Sender<AppEvent>) {
+        self.layout_tx = Some(tx);
+    }
+
+    // When the expanded control strip will close itself if nothing touches it.
+    // While animating there is none; the animation's own deadline comes first.
+    pub fn control_strip_deadline(&self) -> Option<Instant> {
+        if self.control_strip_expanded && !self.is_animating {
+            Some(self.last_input_time + CONTROL_STRIP_TIMEOUT)
+        } else {
+            None
+        }
+    }
+
+    pub fn close_idle_control_strip(&mut self, now: Instant) {
+        if !self.is_animating && self.control_strip_deadline().map_or(false, |deadline| now >= deadline) {
+            log_info!("[app] No input for 5 seconds, closing control strip");
+            self.control_strip_expanded = false;
+            self.page = Page::ControlStripClosing(Arc::clone(&self.expanded_layout));
+            self.animation_start = now;
+            self.is_animating = true;
+            self.needs_redraw = true;
+            self.ignore_input = true;
+        }
+    }
+
+    // What refresh_dynamic reads besides the media info and the time. The main loop only
+    // refreshes when this changes or an event brings new media info, time or layouts.
+    pub fn dynamic_inputs(&self) -> (bool, usize, bool) {
+        (self.media_info_visible, self.active_player_index, matches!(self.gesture, Gesture::ScrubberDrag { .. }))
+    }
+
+    // Rebuilds the clock/media area and adds or drops the media button to match `media_info`.
+    pub fn refresh_dynamic(&mut self, media_info: &Vec<MediaInfo>) {
+        if let Gesture::ScrubberDrag { .. } = self.gesture {
+            return;
+        }
+
+        let new_drawable = if self.media_info_visible && !media_info.is_empty() {
+            DynamicManager::create_media_drawable(media_info, self.active_player_index, self.height)
+        } else {
+            DynamicManager::create_clock_drawable()
+        };
+
+        let layout_changed = self.refresh_default_layout(media_info);
+
+        if layout_changed {
+            if let Page::Default(_) = &self.page {
+                self.page = Page::Default(Arc::clone(&self.default_layout));
+            }
+        }
+
+        if self.dynamic_drawable != new_drawable || layout_changed {
+            self.dynamic_drawable = new_drawable;
+            self.needs_redraw = true;
+        }
+    }
+
+    // Adds or drops the media button. Returns whether the default layout changed; a
+    // variant that isn't built yet is asked for, and this runs again once it's there.
+    fn refresh_default_layout(&mut self, media_info: &Vec<MediaInfo>) -> bool {
+        let wants_media_button = !media_info.is_empty();
+        if self.media_button_visible == wants_media_button && !self.default_layout_stale {
+            return false;
+        }
+        let variant = match &self.layout_tx {
+            Some(tx) => {
+                let variant = self.layouts.cached(media_info);
+                if variant.is_none() {
+                    self.layouts.build_in_background(media_info, tx);
+                }
+                variant
+            }
+            None => self.layouts.default_layout(media_info)
+                .map_err(|e| log_error!("[main] Error: Failed to switch the media button: {}", e))
+                .ok(),
+        };
+        let Some((buttons, bounds)) = variant else { return false };
+        self.default_layout = buttons;
+        self.default_dynamic_area_bounds = bounds;
+        self.media_button_visible = wants_media_button;
+        self.default_layout_stale = false;
+        true
+    }
+
+    pub fn add_layout_variant(&mut self, variant: LayoutVariant) {
+        self.layouts.insert(variant);
+    }
+
+    // Swaps in layouts rebuilt after layout.yml or an icon changed. Whatever page shows
+    // a replaced layout shows the new one from the next frame on.
+    pub fn swap_layouts(&mut self, reloaded: ReloadedLayouts, media_info: &Vec<MediaInfo>) {
+        let old_default = Arc::clone(&self.default_layout);
+        let old_expanded = Arc::clone(&self.expanded_layout);
+
+        if let Some(layouts) = reloaded.default {
+            // the watcher built the variant on screen, unless the player changed meanwhile
+            self.layouts = layouts;
+            self.default_layout_stale = true;
+            self.refresh_default_layout(media_info);
+        }
+        if let Some(expanded) = reloaded.expanded {
+            self.expanded_layout = expanded;
+        }
+
+        let replace = |buttons: &Arc<Vec<Button>>| {
+            if Arc::ptr_eq(buttons, &old_default) {
+                Arc::clone(&self.default_layout)
+            } else if Arc::ptr_eq(buttons, &old_expanded) {
+                Arc::clone(&self.expanded_layout)
+            } else {
+                Arc::clone(buttons)
+            }
+        };
+        let page = match &self.page {
+            Page::Default(buttons) => Page::Default(replace(buttons)),
+            Page::ControlStripExpanding(buttons) => Page::ControlStripExpanding(replace(buttons)),
+            Page::ControlStripClosing(buttons) => Page::ControlStripClosing(replace(buttons)),
+            Page::MediaInfoShowing(buttons) => Page::MediaInfoShowing(replace(buttons)),
+            Page::MediaInfoHiding(buttons) => Page::MediaInfoHiding(replace(buttons)),
+            page => page.clone(),
+        };
+        self.page = page;
+
+        // a held button may not exist in the new layout
+        if let Gesture::ButtonDown { button_index } = self.gesture {
+            let buttons = match &self.page {
+                Page::Default(buttons) | Page::FnKeys(buttons) | Page::ControlStripExpanding(buttons) | Page::ControlStripClosing(buttons) => Some(buttons),
+                _ => None,
+            };
+            if buttons.map_or(true, |buttons| button_index >= buttons.len()) {
+                self.gesture = Gesture::Idle;
+            }
+        }
+        self.needs_redraw = true;
+    }
+
+    pub fn handle_event(&mut self, event: InputEvent, now: Instant, uinput: &mut UInputHandle<File>, latest_media_info: &Arc<Mutex<Vec<MediaInfo>>>, media: &MediaController) -> Result<()> {
         if !self.ignore_input {
-            self.last_input_time = Instant::now();
+            self.last_input_time = now;
         }
         match event {
-            InputEvent::Touch(touch_event) => self.handle_touch_event(touch_event, uinput, latest_media_info)?,
+            InputEvent::Touch(touch_event) => self.handle_touch_event(touch_event, now, uinput, latest_media_info, media)?,
             InputEvent::FnKeyPressed => self.handle_fn_key(true),
             InputEvent::FnKeyReleased => self.handle_fn_key(false),
             InputEvent::KeyPressed(code) => self.handle_key_press(code)?,
@@ -117,7 +327,7 @@ impl AppState {
         self.needs_redraw = true;
     }
 
-    fn handle_touch_event(&mut self, event: TouchEvent, uinput: &mut UInputHandle<File>, latest_media_info: &Arc<Mutex<Vec<MediaInfo>>>) -> Result<()> {
+    fn handle_touch_event(&mut self, event: TouchEvent, now: Instant, uinput: &mut UInputHandle<File>, latest_media_info: &Arc<Mutex<Vec<MediaInfo>>>, media: &MediaController) -> Result<()> {
         if self.is_animating || self.ignore_input {
             return Ok(());
         }
@@ -153,7 +363,7 @@ impl AppState {
 
                         if let Some(scrubber_bounds) = self.dynamic_drawable.scrubber_bounds(&bounds) {
                             if x_down >= scrubber_bounds.x && x_down <= scrubber_bounds.x + scrubber_bounds.width {
-                                println!("[touch] Scrubber tapped. Starting drag.");
+                                log_debug!("[touch] Scrubber tapped. Starting drag.");
                                 self.gesture = Gesture::ScrubberDrag { player_id: primary_info.player_id.clone() };
                                 self.needs_redraw = true;
                                 return Ok(());
@@ -171,7 +381,7 @@ impl AppState {
                             self.needs_redraw = true;
                         } else {
                             self.page = Page::BrightnessSliderClosing(slider.clone());
-                            self.animation_start = Instant::now();
+                            self.animation_start = now;
                             self.is_animating = true;
                             self.gesture = Gesture::Idle;
                             self.needs_redraw = true;
@@ -185,7 +395,7 @@ impl AppState {
                             self.needs_redraw = true;
                         } else {
                             self.page = Page::VolumeSliderClosing(slider.clone());
-                            self.animation_start = Instant::now();
+                            self.animation_start = now;
                             self.is_animating = true;
                             self.gesture = Gesture::Idle;
                             self.needs_redraw = true;
@@ -223,7 +433,7 @@ impl AppState {
                                 if x_motion >= scrubber_bounds.x && x_motion <= scrubber_bounds.x + scrubber_bounds.width {
                                     let progress = ((x_motion - scrubber_bounds.x) / scrubber_bounds.width).max(0.0).min(1.0);
                                     let new_pos_usecs = (progress * primary_info.duration_s() * 1_000_000.0) as i64;
-                                    primary_info.set_position(new_pos_usecs);
+                                    primary_info.set_position(new_pos_usecs, now);
                                     self.needs_redraw = true;
                                 }
                             }
@@ -232,30 +442,11 @@ impl AppState {
                     _ => {}
                 }
             }
-            // NOTE: Cannot be loaded at boot because of this.
             TouchEvent::Up => {
                 if let Gesture::ScrubberDrag { .. } = self.gesture {
                     if !self.control_strip_expanded {
                         if let DynamicDrawable::Media { ref primary_info, .. } = self.dynamic_drawable {
-                            if let (Ok(sudo_user), Ok(sudo_uid)) = (env::var("SUDO_USER"), env::var("SUDO_UID")) {
-                                Command::new("sudo")
-                                    .arg("-u")
-                                    .arg(sudo_user)
-                                    .arg("env")
-                                    .arg(format!("DBUS_SESSION_BUS_ADDRESS=unix:path=/run/user/{}/bus", sudo_uid))
-                                    .arg(format!("XDG_RUNTIME_DIR=/run/user/{}", sudo_uid))
-                                    .arg("/usr/bin/ndfr-media-helper")
-                                    .arg("set-position")
-                                    .arg(&primary_info.player_id)
-                                    .arg(primary_info.position_usecs().to_string())
-                                    .spawn()?;
-                            } else {
-                                Command::new("/usr/bin/ndfr-media-helper")
-                                    .arg("set-position")
-                                    .arg(&primary_info.player_id)
-                                    .arg(primary_info.position_usecs().to_string())
-                                    .spawn()?;
-                            }
+                            media.set_position(&primary_info.player_id, primary_info.position_usecs());
                         }
                     }
                 } else if let Gesture::ButtonDown { button_index } = self.gesture {
@@ -275,7 +466,7 @@ impl AppState {
                             if action == UinputKey::Close || action == UinputKey::Stop {
                                 self.control_strip_expanded = false;
                                 self.page = Page::ControlStripClosing(Arc::clone(&self.expanded_layout));
-                                self.animation_start = Instant::now();
+                                self.animation_start = now;
                                 self.is_animating = true;
                                 self.ignore_input = true;
                             } else {
@@ -287,23 +478,23 @@ impl AppState {
                                 UinputKey::Unknown => {
                                     self.control_strip_expanded = true;
                                     self.page = Page::ControlStripExpanding(Arc::clone(&self.expanded_layout));
-                                    self.animation_start = Instant::now();
+                                    self.animation_start = now;
                                     self.is_animating = true;
                                     self.ignore_input = true;
                                 }
                                 UinputKey::BrightnessDown | UinputKey::BrightnessUp => {
                                     self.page = Page::BrightnessSlider(create_brightness_slider_layout(self.width, self.height, self.brightness_value)?);
-                                    self.animation_start = Instant::now();
+                                    self.animation_start = now;
                                     self.is_animating = true;
                                 }
                                 UinputKey::VolumeUp | UinputKey::VolumeDown => {
                                     self.page = Page::VolumeSlider(create_volume_slider_layout(self.width, self.height, self.volume_value)?);
-                                    self.animation_start = Instant::now();
+                                    self.animation_start = now;
                                     self.is_animating = true;
                                 }
                                 UinputKey::Stop => {
                                     self.media_info_visible = !self.media_info_visible;
-                                    self.animation_start = Instant::now();
+                                    self.animation_start = now;
                                     self.is_animating = true;
                                     if self.media_info_visible {
                                         let info_lock = latest_media_info.lock().unwrap();
@@ -326,7 +517,7 @@ impl AppState {
                 } else if let Gesture::SliderDrag = self.gesture {
                     if let Page::VolumeSlider(slider) = &mut self.page {
                         self.volume_value = slider.value;
-                        self.last_volume_update = Instant::now();
+                        self.last_volume_update = now;
                         self.needs_redraw = true;
                     }
                 }
@@ -345,9 +536,9 @@ impl AppState {
             EvdevKey::KEY_LEFTMETA | EvdevKey::KEY_RIGHTMETA => self.is_super_pressed = true,
             EvdevKey::KEY_6 => {
                 if self.is_super_pressed && self.is_shift_pressed {
-                    println!("[app] Screenshot shortcut detected!");
+                    log_info!("[app] Screenshot shortcut detected!");
                     if let Err(e) = screenshot::take_screenshot(self) {
-                        eprintln!("[screenshot] Failed to take screenshot: {}", e);
+                        log_error!("[screenshot] Failed to take screenshot: {}", e);
                     }
                 }
             }
@@ -365,32 +556,45 @@ impl AppState {
         }
     }
 
-    pub fn get_animation_progress(&self) -> f64 {
-        if !self.is_animating {
-            return 1.0;
-        }
+    pub fn get_animation_progress(&self, now: Instant) -> f64 {
+        animation_progress(&self.page, self.is_animating, self.animation_start, now)
+    }
 
-        let elapsed = self.animation_start.elapsed().as_millis() as f64;
-        let duration = 350.0;
-        let t = (elapsed / duration).min(1.0);
+    // When the running animation reaches its end and update_animations has to settle it.
+    pub fn animation_deadline(&self) -> Option<Instant> {
+        if self.is_animating {
+            Some(self.animation_start + ANIMATION_DURATION)
+        } else {
+            None
+        }
+    }
 
-        let ease_in_out_quad = |t: f64| {
-            if t < 0.5 { 2.0 * t * t } else { -1.0 + (4.0 - 2.0 * t) * t }
+    pub fn snapshot(&self) -> RenderSnapshot {
+        let dynamic_content = match &self.page {
+            Page::Default(layout) if Arc::ptr_eq(layout, &self.default_layout) => {
+                Some((self.dynamic_drawable.clone(), self.default_dynamic_area_bounds))
+            }
+            Page::MediaInfoShowing(_) | Page::MediaInfoHiding(_) => {
+                Some((self.dynamic_drawable.clone(), self.default_dynamic_area_bounds))
+            }
+            _ => None,
         };
-
-        match &self.page {
-            Page::BrightnessSlider(_) | Page::VolumeSlider(_) | Page::ControlStripExpanding(_) | Page::MediaInfoShowing(_) => ease_in_out_quad(t),
-            Page::BrightnessSliderClosing(_) | Page::VolumeSliderClosing(_) | Page::ControlStripClosing(_) | Page::MediaInfoHiding(_) => 1.0 - ease_in_out_quad(t),
-            _ => 1.0,
+        RenderSnapshot {
+            page: self.page.clone(),
+            gesture: self.gesture.clone(),
+            dynamic_content,
+            input: None,
+            animation_start: self.animation_start,
+            is_animating: self.is_animating,
         }
     }
 
-    pub fn update_animations(&mut self) {
+    pub fn update_animations(&mut self, now: Instant) {
         if !self.is_animating {
             return;
         }
 
-        let progress = self.get_animation_progress();
+        let progress = self.get_animation_progress(now);
 
         let animation_finished = match self.page {
             Page::BrightnessSlider(_) | Page::VolumeSlider(_) | Page::ControlStripExpanding(_) | Page::MediaInfoShowing(_) => progress >= 1.0,
@@ -400,6 +604,7 @@ impl AppState {
 
         if animation_finished {
             self.is_animating = false;
+            self.needs_redraw = true;
 
             match &self.page {
                 Page::BrightnessSliderClosing(_) | Page::VolumeSliderClosing(_) => {
@@ -423,6 +628,5 @@ impl AppState {
                 _ => {}
             }
         }
-        self.needs_redraw = self.is_animating;
     }
 }
@@ -1,49 +1,105 @@
 use anyhow::{anyhow, Result};
-use std::process::Command;
+use nix::poll::{poll, PollFd, PollFlags};
+use std::fs::{self, File, OpenOptions};
+use std::os::unix::fs::FileExt;
+use std::path::{Path, PathBuf};
 
-pub struct Backlight {}
+const BACKLIGHT_CLASS: &str = "/sys/class/backlight";
+
+// Talks to the display's backlight device in sysfs directly.
+pub struct Backlight {
+    device: PathBuf,
+    max: u32,
+    brightness: File,
+    actual_brightness: File,
+}
+
+// Blocks until something (us, a hotkey, another program) changes the backlight.
+pub struct BacklightWatcher {
+    max: u32,
+    last: u32,
+    actual_brightness: File,
+}
+
+fn read_value(file: &File) -> Result<u32> {
+    let mut buf = [0u8; 32];
+    let len = file.read_at(&mut buf, 0)?;
+    Ok(std::str::from_utf8(&buf[..len])?.trim().parse()?)
+}
+
+fn fraction(value: u32, max: u32) -> f64 {
+    if max == 0 {
+        0.0
+    } else {
+        value as f64 / max as f64
+    }
+}
+
+// The kernel documents firmware interfaces as preferable to platform ones,
+// and both as preferable to raw GPU registers.
+fn device_rank(device: &Path) -> Option<u32> {
+    let name = device.file_name()?.to_str()?;
+    // that's the Touch Bar's own backlight, not the display's
+    if name.starts_with("appletb") {
+        return None;
+    }
+    match fs::read_to_string(device.join("type")).ok()?.trim() {
+        "firmware" => Some(0),
+        "platform" => Some(1),
+        "raw" => Some(2),
+        _ => Some(3),
+    }
+}
+
+fn find_device() -> Result<PathBuf> {
+    fs::read_dir(BACKLIGHT_CLASS)?
+        .filter_map(|entry| entry.ok().map(|e| e.path()))
+        .filter_map(|path| device_rank(&path).map(|rank| (rank, path)))
+        .min()
+        .map(|(_, path)| path)
+        .ok_or(anyhow!("No display backlight found in {}", BACKLIGHT_CLASS))
+}
 
 impl Backlight {
     pub fn new() -> Result<Self> {
-        if !Command::new("/usr/bin/brightnessctl").arg("--version").output()?.status.success() {
-            return Err(anyhow!("brightnessctl command not found at /usr/bin/brightnessctl. Please install it."));
-        }
-        Ok(Backlight {})
+        let device = find_device()?;
+        let max = read_value(&File::open(device.join("max_brightness"))?)?;
+        let brightness = OpenOptions::new().write(true).open(device.join("brightness"))?;
+        let actual_brightness = File::open(device.join("actual_brightness"))?;
+        log_info!("[backlight] Using {} (max {})", device.display(), max);
+        Ok(Backlight { device, max, brightness, actual_brightness })
     }
 
     pub fn set_brightness(&self, value: f64) -> Result<()> {
-        let percent = (value * 100.0).round() as u32;
-        let status = Command::new("/usr/bin/brightnessctl")
-            .arg("--quiet")
-            .arg("set")
-            .arg(format!("{}%", percent))
-            .status()?;
-
-        if !status.success() {
-            return Err(anyhow!("Failed to set brightness using brightnessctl."));
-        }
+        let raw = (value.clamp(0.0, 1.0) * self.max as f64).round() as u32;
+        self.brightness.write_at(raw.to_string().as_bytes(), 0)?;
         Ok(())
     }
 
     pub fn get_brightness(&self) -> Result<f64> {
-        let output = Command::new("/usr/bin/brightnessctl").arg("get").output()?;
-        if !output.status.success() {
-            return Err(anyhow!("Failed to get brightness from brightnessctl."));
-        }
-        let current_str = String::from_utf8_lossy(&output.stdout);
-        let current: f64 = current_str.trim().parse()?;
+        Ok(fraction(read_value(&self.actual_brightness)?, self.max))
+    }
 
-        let max_output = Command::new("/usr/bin/brightnessctl").arg("max").output()?;
-        if !max_output.status.success() {
-            return Err(anyhow!("Failed to get max brightness from brightnessctl."));
-        }
-        let max_str = String::from_utf8_lossy(&max_output.stdout);
-        let max: f64 = max_str.trim().parse()?;
+    pub fn watcher(&self) -> Result<BacklightWatcher> {
+        let actual_brightness = File::open(self.device.join("actual_brightness"))?;
+        let last = read_value(&actual_brightness)?;
+        Ok(BacklightWatcher { max: self.max, last, actual_brightness })
+    }
+}
 
-        if max == 0.0 {
-            Ok(0.0)
-        } else {
-            Ok(current / max)
+impl BacklightWatcher {
+    // The backlight core raises a sysfs notification on actual_brightness whenever
+    // the level changes. Reading the attribute re-arms it, and also catches a change
+    // that landed between two calls.
+    pub fn wait(&mut self) -> Result<f64> {
+        loop {
+            let current = read_value(&self.actual_brightness)?;
+            if current != self.last {
+                self.last = current;
+                return Ok(fraction(current, self.max));
+            }
+            let mut fds = [PollFd::new(&self.actual_brightness, PollFlags::POLLPRI | PollFlags::POLLERR)];
+            poll(&mut fds, -1)?;
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,157 @@
+// `dfr_daemon bench [frames]`: renders every kind of page through the offscreen presenter
+// and reports what a frame costs, so rendering changes can be compared on machines
+// without a Touch Bar.
+
+use crate::app::Gesture;
+use crate::dynamic::{DynamicDrawable, DynamicManager, Rect};
+use crate::icons;
+use crate::media::{MediaInfo, PlaybackStatus};
+use crate::offscreen::OffscreenBackend;
+use crate::renderer::{self, DamageTracker, Presenter};
+use crate::ui::{create_brightness_slider_layout, create_expanded_layout, create_fn_layout, create_volume_slider_layout, LayoutCompiler, Page};
+use anyhow::Result;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+// the 16" panel, in its physical (portrait) orientation
+pub const PANEL_WIDTH: i32 = 60;
+pub const PANEL_HEIGHT: i32 = 2170;
+const WARMUP_FRAMES: usize = 10;
+pub const DEFAULT_FRAMES: usize = 500;
+
+struct Case {
+    name: &'static str,
+    // a single frame is repainted in full every time; several alternate through the
+    // damage tracker, so only what changes between them is redrawn
+    frames: Vec<(Page, Gesture)>,
+    dynamic_content: Option<(DynamicDrawable, Rect)>,
+    animation_progress: f64,
+}
+
+fn cases(width: i32, height: i32) -> Result<Vec<Case>> {
+    let mut layouts = LayoutCompiler::new(width, height, false)?;
+    let (default_layout, default_bounds) = layouts.default_layout(&[])?;
+    let media = vec![MediaInfo::new(
+        "org.mpris.MediaPlayer2.spotify".to_string(),
+        PlaybackStatus::Playing,
+        "Benchmark Track".to_string(),
+        "Benchmark Artist".to_string(),
+        200_000_000,
+    )];
+    let (media_layout, media_bounds) = layouts.default_layout(&media)?;
+    let expanded_layout = Arc::new(create_expanded_layout(width, height)?);
+    let fn_layout = Arc::new(create_fn_layout(width, height)?);
+    let clock = Some((DynamicManager::create_clock_drawable(), default_bounds));
+    let idle = Gesture::Idle;
+    let pressed = Gesture::ButtonDown { button_index: 1 };
+
+    Ok(vec![
+        Case {
+            name: "default, clock",
+            frames: vec![(Page::Default(Arc::clone(&default_layout)), idle.clone())],
+            dynamic_content: clock.clone(),
+            animation_progress: 1.0,
+        },
+        Case {
+            name: "default, media",
+            frames: vec![(Page::Default(Arc::clone(&media_layout)), idle.clone())],
+            dynamic_content: Some((DynamicManager::create_media_drawable(&media, 0, height), media_bounds)),
+            animation_progress: 1.0,
+        },
+        Case {
+            name: "default, button press (damaged)",
+            frames: vec![
+                (Page::Default(Arc::clone(&default_layout)), idle.clone()),
+                (Page::Default(Arc::clone(&default_layout)), pressed.clone()),
+            ],
+            dynamic_content: clock,
+            animation_progress: 1.0,
+        },
+        Case {
+            name: "fn keys",
+            frames: vec![(Page::FnKeys(Arc::clone(&fn_layout)), idle.clone())],
+            dynamic_content: None,
+            animation_progress: 1.0,
+        },
+        Case {
+            name: "brightness slider opening",
+            frames: vec![(Page::BrightnessSlider(create_brightness_slider_layout(width, height, 0.5)?), idle.clone())],
+            dynamic_content: None,
+            animation_progress: 0.5,
+        },
+        Case {
+            name: "volume slider closing",
+            frames: vec![(Page::VolumeSliderClosing(create_volume_slider_layout(width, height, 0.5)?), idle.clone())],
+            dynamic_content: None,
+            animation_progress: 0.5,
+        },
+        Case {
+            name: "control strip expanding",
+            frames: vec![(Page::ControlStripExpanding(Arc::clone(&expanded_layout)), idle.clone())],
+            dynamic_content: None,
+            animation_progress: 0.5,
+        },
+    ])
+}
+
+// Draws `count` frames of `case` like the render loop would and returns each one's time.
+fn run_case(presenter: &mut OffscreenBackend, case: &Case, count: usize) -> Result<Vec<Duration>> {
+    let mut surfaces = presenter.surfaces()?;
+    let mut damage_tracker = DamageTracker::new(presenter.get_dimensions().0);
+    let mut times = Vec::with_capacity(count);
+    for i in 0..WARMUP_FRAMES + count {
+        let (page, gesture) = &case.frames[i % case.frames.len()];
+        let start = Instant::now();
+        // a static frame would be all undamaged after the first draw and time nothing
+        let damage = if case.frames.len() > 1 {
+            damage_tracker.track(page, gesture, case.dynamic_content.as_ref(), case.animation_progress)
+        } else {
+            None
+        };
+        let (back, repaint) = presenter.begin_frame(damage.as_deref())?;
+        let surface = &mut surfaces[back];
+        renderer::draw_ui(
+            surface,
+            page,
+            gesture,
+            case.dynamic_content.as_ref().map(|(d, r)| (d, r)),
+            case.animation_progress,
+            start,
+            false,
+            repaint.as_deref(),
+        )?;
+        presenter.present(surface, repaint.as_deref(), damage.as_deref())?;
+        if i >= WARMUP_FRAMES {
+            times.push(start.elapsed());
+        }
+    }
+    Ok(times)
+}
+
+fn percentile(sorted: &[Duration], p: f64) -> Duration {
+    sorted[((sorted.len() - 1) as f64 * p).round() as usize]
+}
+
+pub fn run(frames: usize) -> Result<()> {
+    let frames = frames.max(1);
+    let (logical_width, logical_height) = (PANEL_HEIGHT, PANEL_WIDTH);
+    icons::init(logical_height)?;
+
+    let mut presenter = OffscreenBackend::new(PANEL_WIDTH, PANEL_HEIGHT);
+    println!("[bench] {} frames per case, {}x{} panel", frames, PANEL_WIDTH, PANEL_HEIGHT);
+    println!("{:<34} {:>10} {:>10} {:>10} {:>10}", "case", "mean us", "p50 us", "p99 us", "max us");
+    for case in cases(logical_width, logical_height)? {
+        let mut times = run_case(&mut presenter, &case, frames)?;
+        times.sort();
+        let mean = times.iter().sum::<Duration>() / times.len() as u32;
+        println!(
+            "{:<34} {:>10} {:>10} {:>10} {:>10}",
+            case.name,
+            mean.as_micros(),
+            percentile(&times, 0.5).as_micros(),
+            percentile(&times, 0.99).as_micros(),
+            times[times.len() - 1].as_micros(),
+        );
+    }
+    Ok(())
+}
@@ -0,0 +1,66 @@
+// Wakes the main loop when the clock's minute changes. The timer is armed on the wall
+// clock for the next whole minute, with TFD_TIMER_CANCEL_ON_SET so that a clock change
+// (NTP step, manual set, resume) cancels it and the displayed time is fixed right away.
+
+use crate::app::AppEvent;
+use anyhow::Result;
+use std::io;
+use std::mem;
+use std::sync::mpsc::Sender;
+use std::thread;
+
+struct TimerFd(libc::c_int);
+
+impl TimerFd {
+    fn new() -> Result<Self> {
+        let fd = unsafe { libc::timerfd_create(libc::CLOCK_REALTIME, libc::TFD_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error().into());
+        }
+        Ok(TimerFd(fd))
+    }
+
+    fn arm_for_next_minute(&self) -> Result<()> {
+        let mut now: libc::timespec = unsafe { mem::zeroed() };
+        unsafe { libc::clock_gettime(libc::CLOCK_REALTIME, &mut now) };
+        let mut spec: libc::itimerspec = unsafe { mem::zeroed() };
+        spec.it_value.tv_sec = now.tv_sec - now.tv_sec % 60 + 60;
+        let flags = libc::TFD_TIMER_ABSTIME | libc::TFD_TIMER_CANCEL_ON_SET;
+        if unsafe { libc::timerfd_settime(self.0, flags, &spec, std::ptr::null_mut()) } < 0 {
+            return Err(io::Error::last_os_error().into());
+        }
+        Ok(())
+    }
+
+    // Blocks until the timer fires. ECANCELED means the wall clock was changed,
+    // which needs the same refresh.
+    fn wait(&self) -> Result<()> {
+        let mut expirations = 0u64;
+        let len = mem::size_of_val(&expirations);
+        if unsafe { libc::read(self.0, &mut expirations as *mut u64 as *mut libc::c_void, len) } < 0 {
+            let err = io::Error::last_os_error();
+            if err.raw_os_error() != Some(libc::ECANCELED) && err.kind() != io::ErrorKind::Interrupted {
+                return Err(err.into());
+            }
+        }
+        Ok(())
+    }
+}
+
+impl Drop for TimerFd {
+    fn drop(&mut self) {
+        unsafe { libc::close(self.0) };
+    }
+}
+
+pub fn start_clock(tx: Sender<AppEvent>) -> Result<()> {
+    let timer = TimerFd::new()?;
+    thread::spawn(move || -> Result<()> {
+        loop {
+            timer.arm_for_next_minute()?;
+            timer.wait()?;
+            tx.send(AppEvent::ClockTick)?;
+        }
+    });
+    Ok(())
+}
@@ -2,11 +2,12 @@ use anyhow::Result;
 use cairo::{Context, Format, ImageSurface, SurfacePattern};
 use crate::media::MediaInfo;
 use std::path::PathBuf;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
 use tiny_skia::{Pixmap, Transform};
 use usvg::Tree;
 
-#[derive(Copy, Clone, Debug)]
+#[derive(Copy, Clone, Debug, PartialEq)]
 pub struct Rect {
     pub x: f64,
     pub y: f64,
@@ -83,7 +84,19 @@ impl DynamicDrawable {
         }
     }
 
-    pub fn draw(&self, c: &Context, bounds: &Rect, is_dragging: bool) -> Result<()> {
+    // How long until the playhead of a playing track moves by a whole pixel, if it moves at all.
+    pub fn next_redraw(&self, bounds: &Rect) -> Option<Duration> {
+        match self {
+            DynamicDrawable::Media { primary_info, .. } if primary_info.is_advancing() => {
+                let scrubber_bounds = self.scrubber_bounds(bounds)?;
+                let secs_per_pixel = primary_info.duration_s() / scrubber_bounds.width / primary_info.rate;
+                Some(Duration::from_secs_f64(secs_per_pixel))
+            }
+            _ => None,
+        }
+    }
+
+    pub fn draw(&self, c: &Context, bounds: &Rect, is_dragging: bool, now: Instant) -> Result<()> {
         match self {
             DynamicDrawable::Clock(time_str) => {
                 c.set_source_rgb(0.8, 0.8, 0.8);
@@ -108,13 +121,13 @@ impl DynamicDrawable {
                 c.set_source_rgb(button_color, button_color, button_color);
                 c.fill()?;
 
-                self.draw_media_contents(c, bounds, is_dragging, primary_info)?;
+                self.draw_media_contents(c, bounds, is_dragging, primary_info, now)?;
             }
         }
         Ok(())
     }
 
-    fn draw_media_contents(&self, c: &Context, bounds: &Rect, is_dragging: bool, primary_info: &MediaInfo) -> Result<()> {
+    fn draw_media_contents(&self, c: &Context, bounds: &Rect, is_dragging: bool, primary_info: &MediaInfo, now: Instant) -> Result<()> {
         if let DynamicDrawable::Media { primary_icon_pixmap, secondary_icon_pixmap, scrubber_texture_data, .. } = self {
             let icon_size = bounds.height * 0.7;
             let radius = 8.0;
@@ -176,7 +189,9 @@ impl DynamicDrawable {
                 }
 
                 if primary_info.duration_s() > 0.0 {
-                    let progress = (primary_info.position_s() / primary_info.duration_s()).min(1.0).max(0.0);
+                    // while dragging the sample is the dragged-to position and must not run ahead
+                    let position_s = if is_dragging { primary_info.position_s() } else { primary_info.position_s_at(now) };
+                    let progress = (position_s / primary_info.duration_s()).min(1.0).max(0.0);
                     let playhead_x = scrubber_bounds.x + scrubber_bounds.width * progress;
                     if is_dragging {
                         let box_width = 80.0;
@@ -192,7 +207,7 @@ impl DynamicDrawable {
                         c.close_path();
                         c.set_source_rgb(0.9, 0.9, 0.9);
                         c.fill()?;
-                        let pos_s = primary_info.position_s() as i32;
+                        let pos_s = position_s as i32;
                         let time_str = format!("{:02}:{:02}", pos_s / 60, pos_s % 60);
                         c.set_source_rgb(0.0, 0.0, 0.0);
                         c.set_font_size(22.0);
@@ -215,6 +230,79 @@ impl DynamicDrawable {
     }
 }
 
+// Rasterized player icons, least recently used first. Misses are cached as well, so a
+// player without an installed icon does not cost a round of `stat`s on every update.
+const ICON_CACHE_CAPACITY: usize = 16;
+
+struct IconCache {
+    entries: Vec<((String, u32), Option<Arc<Pixmap>>)>,
+}
+
+static ICON_CACHE: Mutex<IconCache> = Mutex::new(IconCache { entries: Vec::new() });
+static SCRUBBER_TEXTURE: Mutex<Option<(i32, Arc<Vec<u8>>)>> = Mutex::new(None);
+
+impl IconCache {
+    fn get(&mut self, icon_name: &str, size: u32) -> Option<Arc<Pixmap>> {
+        if let Some(index) = self.entries.iter().position(|((name, s), _)| name == icon_name && *s == size) {
+            let entry = self.entries.remove(index);
+            let pixmap = entry.1.clone();
+            self.entries.push(entry);
+            return pixmap;
+        }
+
+        let pixmap = rasterize_app_icon(icon_name, size).map(Arc::new);
+        if self.entries.len() >= ICON_CACHE_CAPACITY {
+            self.entries.remove(0);
+        }
+        self.entries.push(((icon_name.to_string(), size), pixmap.clone()));
+        pixmap
+    }
+}
+
+fn rasterize_app_icon(icon_name: &str, size: u32) -> Option<Pixmap> {
+    let svg_data = std::fs::read(find_icon_path(icon_name)?).ok()?;
+    let tree = Tree::from_data(&svg_data, &usvg::Options::default()).ok()?;
+    let mut pm = Pixmap::new(size, size)?;
+    let transform = Transform::from_scale(
+        size as f32 / tree.size().width(),
+        size as f32 / tree.size().height(),
+    );
+    resvg::render(&tree, transform, &mut pm.as_mut());
+    Some(pm)
+}
+
+fn cached_app_icon(icon_name: &str, height: i32) -> Option<Arc<Pixmap>> {
+    if icon_name.is_empty() {
+        return None;
+    }
+    let icon_size = (height as f64 * 0.7) as u32;
+    ICON_CACHE.lock().unwrap().get(icon_name, icon_size)
+}
+
+// The scrubber's tick texture only depends on the strip height, so every drawable shares one.
+fn scrubber_texture(height: i32) -> Arc<Vec<u8>> {
+    let mut cached = SCRUBBER_TEXTURE.lock().unwrap();
+    if let Some((cached_height, texture)) = cached.as_ref() {
+        if *cached_height == height {
+            return Arc::clone(texture);
+        }
+    }
+
+    let width = 3;
+    let stride = Format::ARgb32.stride_for_width(width).unwrap();
+    let mut texture_data = vec![0; (stride * height) as usize];
+    let line_color = [0x33, 0x33, 0x33, 0xFF];
+    for y in 0..height {
+        let line_start = (y * stride) as usize;
+        let pixel_start = line_start + 1 * 4;
+        texture_data[pixel_start..pixel_start + 4].copy_from_slice(&line_color);
+    }
+
+    let texture = Arc::new(texture_data);
+    *cached = Some((height, Arc::clone(&texture)));
+    texture
+}
+
 pub struct DynamicManager;
 
 impl DynamicManager {
@@ -235,58 +323,15 @@ impl DynamicManager {
             None
         };
 
-        let mut primary_icon_pixmap = None;
-        if let Some(icon_path) = find_icon_path(&primary_info.icon_name) {
-            if let Ok(svg_data) = std::fs::read(icon_path) {
-                if let Ok(tree) = Tree::from_data(&svg_data, &usvg::Options::default()) {
-                    let icon_size = height as f64 * 0.7;
-                    if let Some(mut pm) = Pixmap::new(icon_size as u32, icon_size as u32) {
-                        let transform = Transform::from_scale(
-                            icon_size as f32 / tree.size().width(),
-                            icon_size as f32 / tree.size().height(),
-                        );
-                        resvg::render(&tree, transform, &mut pm.as_mut());
-                        primary_icon_pixmap = Some(Arc::new(pm));
-                    }
-                }
-            }
-        }
-
-        let mut secondary_icon_pixmap = None;
-        if let Some(sec_info) = &secondary_info {
-            if let Some(icon_path) = find_icon_path(&sec_info.icon_name) {
-                if let Ok(svg_data) = std::fs::read(icon_path) {
-                    if let Ok(tree) = Tree::from_data(&svg_data, &usvg::Options::default()) {
-                        let icon_size = height as f64 * 0.7;
-                        if let Some(mut pm) = Pixmap::new(icon_size as u32, icon_size as u32) {
-                            let transform = Transform::from_scale(
-                                icon_size as f32 / tree.size().width(),
-                                icon_size as f32 / tree.size().height(),
-                            );
-                            resvg::render(&tree, transform, &mut pm.as_mut());
-                            secondary_icon_pixmap = Some(Arc::new(pm));
-                        }
-                    }
-                }
-            }
-        }
-
-        let width = 3;
-        let stride = Format::ARgb32.stride_for_width(width).unwrap();
-        let mut texture_data = vec![0; (stride * height) as usize];
-        let line_color = [0x33, 0x33, 0x33, 0xFF];
-        for y in 0..height {
-            let line_start = (y * stride) as usize;
-            let pixel_start = line_start + 1 * 4;
-            texture_data[pixel_start..pixel_start + 4].copy_from_slice(&line_color);
-        }
+        let primary_icon_pixmap = cached_app_icon(&primary_info.icon_name, height);
+        let secondary_icon_pixmap = secondary_info.as_ref().and_then(|info| cached_app_icon(&info.icon_name, height));
 
         DynamicDrawable::Media {
             primary_info,
             secondary_info,
             primary_icon_pixmap,
             secondary_icon_pixmap,
-            scrubber_texture_data: Some(Arc::new(texture_data)),
+            scrubber_texture_data: Some(scrubber_texture(height)),
         }
     }
 }
@@ -0,0 +1,88 @@
+// Kernel uevents over netlink, so threads that own a device can notice it coming back
+// after a USB reset or a suspend/resume cycle. devtmpfs has created (or removed) the
+// device node by the time the event is sent.
+
+use anyhow::Result;
+use nix::errno::Errno;
+use nix::poll::{poll, PollFd, PollFlags};
+use nix::sys::socket::{bind, recv, socket, AddressFamily, MsgFlags, NetlinkAddr, SockFlag, SockProtocol, SockType};
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd, OwnedFd};
+use std::time::Duration;
+
+const KERNEL_EVENTS_GROUP: u32 = 1;
+const UEVENT_BUFFER_LEN: usize = 8192;
+
+pub struct Monitor {
+    socket: OwnedFd,
+    subsystem: &'static str,
+    buf: Box<[u8; UEVENT_BUFFER_LEN]>,
+}
+
+impl Monitor {
+    // Only reports events for `subsystem` ("input", "drm", ...).
+    pub fn new(subsystem: &'static str) -> Result<Self> {
+        let socket = socket(
+            AddressFamily::Netlink,
+            SockType::Datagram,
+            SockFlag::SOCK_NONBLOCK | SockFlag::SOCK_CLOEXEC,
+            SockProtocol::NetlinkKObjectUEvent,
+        )?;
+        bind(socket.as_raw_fd(), &NetlinkAddr::new(0, KERNEL_EVENTS_GROUP))?;
+        Ok(Monitor { socket, subsystem, buf: Box::new([0; UEVENT_BUFFER_LEN]) })
+    }
+
+    // Returns the action ("add", "remove", "change", ...) of the next queued event for
+    // our subsystem, or None once the queue is empty.
+    fn receive(&mut self) -> Result<Option<String>> {
+        loop {
+            let len = match recv(self.socket.as_raw_fd(), &mut self.buf[..], MsgFlags::empty()) {
+                Ok(len) => len,
+                Err(Errno::EAGAIN) => return Ok(None),
+                Err(e) => return Err(e.into()),
+            };
+
+            // "action@devpath", then NUL separated KEY=value pairs
+            let mut action = None;
+            let mut subsystem = None;
+            for field in self.buf[..len].split(|&b| b == 0).skip(1) {
+                let field = String::from_utf8_lossy(field);
+                if let Some((key, value)) = field.split_once('=') {
+                    match key {
+                        "ACTION" => action = Some(value.to_string()),
+                        "SUBSYSTEM" => subsystem = Some(value.to_string()),
+                        _ => {}
+                    }
+                }
+            }
+
+            if let (Some(action), Some(subsystem)) = (action, subsystem) {
+                if subsystem == self.subsystem {
+                    return Ok(Some(action));
+                }
+            }
+        }
+    }
+
+    // Blocks until an event may be waiting, or `timeout` passes.
+    pub fn wait(&self, timeout: Option<Duration>) -> Result<()> {
+        let timeout = timeout.map_or(-1, |t| t.as_millis().min(i32::MAX as u128) as i32);
+        let mut fds = [PollFd::new(&self.socket, PollFlags::POLLIN)];
+        poll(&mut fds, timeout)?;
+        Ok(())
+    }
+
+    // Empties the queue and reports whether a device showed up (or changed) meanwhile.
+    pub fn drain(&mut self) -> Result<bool> {
+        let mut appeared = false;
+        while let Some(action) = self.receive()? {
+            appeared |= action == "add" || action == "change";
+        }
+        Ok(appeared)
+    }
+}
+
+impl AsFd for Monitor {
+    fn as_fd(&self) -> BorrowedFd<'_> {
+        self.socket.as_fd()
+    }
+}
@@ -0,0 +1,105 @@
+use crate::sprite::Sprite;
+use crate::ui::find_resource_path;
+use anyhow::{anyhow, Result};
+use std::collections::HashMap;
+use std::fs;
+use std::path::Path;
+use std::sync::{Arc, Mutex, OnceLock};
+use tiny_skia::{Pixmap, Transform};
+use usvg::Tree;
+
+struct Icon {
+    tree: Arc<Tree>,
+    masks: Vec<(u32, Arc<Sprite>)>,
+}
+
+// Every SVG under icons/, parsed once at startup, with masks rasterized at the size the
+// buttons and sliders draw them. Other sizes are rasterized on first use and kept.
+pub struct IconAtlas {
+    icons: Mutex<HashMap<String, Icon>>,
+    mask_size: u32,
+}
+
+static ATLAS: OnceLock<IconAtlas> = OnceLock::new();
+
+pub fn rasterize(tree: &Tree, size: u32) -> Result<Pixmap> {
+    let mut pixmap = Pixmap::new(size.max(1), size.max(1)).ok_or_else(|| anyhow!("Invalid icon size {}", size))?;
+    let transform = Transform::from_scale(
+        size as f32 / tree.size().width(),
+        size as f32 / tree.size().height(),
+    );
+    resvg::render(tree, transform, &mut pixmap.as_mut());
+    Ok(pixmap)
+}
+
+fn load_icon(path: &Path, mask_size: u32) -> Result<Icon> {
+    let tree = Tree::from_data(&fs::read(path)?, &usvg::Options::default())?;
+    let mask = Sprite::from_pixmap(&rasterize(&tree, mask_size)?)?;
+    Ok(Icon { tree: Arc::new(tree), masks: vec![(mask_size, Arc::new(mask))] })
+}
+
+impl IconAtlas {
+    fn load(mask_size: u32) -> Result<Self> {
+        let mut icons = HashMap::new();
+        for entry in fs::read_dir(find_resource_path("icons")?)? {
+            let path = entry?.path();
+            let Some(name) = path.file_name().and_then(|n| n.to_str()).filter(|n| n.ends_with(".svg")) else {
+                continue;
+            };
+            // like a reload, a bad file is skipped; a layout that uses it reports it missing
+            match load_icon(&path, mask_size) {
+                Ok(icon) => {
+                    icons.insert(name.to_string(), icon);
+                }
+                Err(e) => log_warn!("[icons] Skipping {}: {}", name, e),
+            }
+        }
+        log_info!("[icons] Loaded {} icons", icons.len());
+        Ok(IconAtlas { icons: Mutex::new(icons), mask_size })
+    }
+
+    // Picks up an edited, added or deleted icons/<name>. Layouts already built keep the
+    // trees and sprites they were built with until they are rebuilt.
+    pub fn reload(&self, name: &str) -> Result<()> {
+        let path = find_resource_path("icons")?.join(name);
+        if !path.exists() {
+            self.icons.lock().unwrap().remove(name);
+            return Ok(());
+        }
+        // parsed outside the lock, so lookups from the main thread don't wait on it
+        let icon = load_icon(&path, self.mask_size)?;
+        self.icons.lock().unwrap().insert(name.to_string(), icon);
+        Ok(())
+    }
+
+    pub fn tree(&self, name: &str) -> Result<Arc<Tree>> {
+        let icons = self.icons.lock().unwrap();
+        let icon = icons.get(name).ok_or_else(|| anyhow!("Could not find icon: {}", name))?;
+        Ok(Arc::clone(&icon.tree))
+    }
+
+    pub fn mask(&self, name: &str, size: u32) -> Result<Arc<Sprite>> {
+        let mut icons = self.icons.lock().unwrap();
+        let icon = icons.get_mut(name).ok_or_else(|| anyhow!("Could not find icon: {}", name))?;
+        if let Some((_, mask)) = icon.masks.iter().find(|(s, _)| *s == size) {
+            return Ok(Arc::clone(mask));
+        }
+        let mask = Arc::new(Sprite::from_pixmap(&rasterize(&icon.tree, size)?)?);
+        icon.masks.push((size, Arc::clone(&mask)));
+        Ok(mask)
+    }
+}
+
+// The size buttons and sliders draw their icons at on a strip of the given height.
+pub fn icon_size(height: f64) -> u32 {
+    (height * 0.6) as u32
+}
+
+pub fn init(height: i32) -> Result<()> {
+    let atlas = IconAtlas::load(icon_size(height as f64))?;
+    ATLAS.set(atlas).map_err(|_| anyhow!("Icon atlas is already loaded"))
+}
+
+pub fn atlas() -> &'static IconAtlas {
+    ATLAS.get().expect("icon atlas is loaded at startup")
+}
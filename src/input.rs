@@ -1,7 +1,17 @@
 use anyhow::{anyhow, Result};
-use evdev::{Device, InputEventKind, Key, AbsoluteAxisType};
+use evdev::{Device, Key, AbsoluteAxisType};
+use nix::errno::Errno;
+use nix::fcntl::{fcntl, FcntlArg, OFlag};
+use nix::poll::{poll, PollFd, PollFlags};
+use nix::unistd::read;
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd, RawFd};
 use std::sync::mpsc::Sender;
+use crate::app::AppEvent;
+use crate::hotplug::Monitor;
+use crate::latency;
+use crate::record;
 use std::thread;
+use std::time::{Duration, Instant};
 
 #[derive(Debug)]
 pub enum TouchEvent {
@@ -19,6 +29,29 @@ pub enum InputEvent {
     FnKeyReleased,
 }
 
+impl InputEvent {
+    pub fn kind(&self) -> &'static str {
+        match self {
+            InputEvent::Touch(TouchEvent::Down(_)) => "touch_down",
+            InputEvent::Touch(TouchEvent::Up) => "touch_up",
+            InputEvent::Touch(TouchEvent::Motion(_)) => "touch_motion",
+            InputEvent::KeyPressed(_) | InputEvent::FnKeyPressed => "key_down",
+            InputEvent::KeyReleased(_) | InputEvent::FnKeyReleased => "key_up",
+        }
+    }
+}
+
+// Queues `event` onto `batch`, replacing a touch motion that is still waiting there
+// with a newer one. Everything else, Down and Up included, keeps its place and order.
+pub fn coalesce(batch: &mut Vec<AppEvent>, event: AppEvent) {
+    if let AppEvent::Input(InputEvent::Touch(TouchEvent::Motion(_)), _) = event {
+        if let Some(AppEvent::Input(InputEvent::Touch(TouchEvent::Motion(_)), _)) = batch.last() {
+            batch.pop();
+        }
+    }
+    batch.push(event);
+}
+
 pub struct KeyboardFeatures {
     pub device: Device,
     pub has_physical_esc: bool,
@@ -31,8 +64,8 @@ pub fn find_keyboard_features() -> Result<KeyboardFeatures> {
             if let Some(keys) = device.supported_keys() {
                 if keys.contains(Key::KEY_FN) {
                     let has_physical_esc = keys.contains(Key::KEY_ESC);
-                    println!("[keyboard] Found keyboard device at {}", path);
-                    println!("[keyboard] Physical ESC key detected: {}", has_physical_esc);
+                    log_info!("[keyboard] Found keyboard device at {}", path);
+                    log_info!("[keyboard] Physical ESC key detected: {}", has_physical_esc);
                     return Ok(KeyboardFeatures { device, has_physical_esc });
                 }
             }
@@ -41,51 +74,12 @@ pub fn find_keyboard_features() -> Result<KeyboardFeatures> {
     Err(anyhow!("Could not find a suitable keyboard device."))
 }
 
-pub fn start_keyboard_handler(tx: Sender<InputEvent>, mut device: Device) -> Result<()> {
-    thread::spawn(move || loop {
-        match device.fetch_events() {
-            Ok(events) => {
-                for ev in events {
-                    if let InputEventKind::Key(key) = ev.kind() {
-                        if key.code() == Key::KEY_FN.code() {
-                            if ev.value() == 1 {
-                                println!("[keyboard] Fn key pressed");
-                                tx.send(InputEvent::FnKeyPressed).unwrap();
-                            } else if ev.value() == 0 {
-                                println!("[keyboard] Fn key released");
-                                tx.send(InputEvent::FnKeyReleased).unwrap();
-                            }
-                        } else {
-                            match ev.value() {
-                                1 => {
-                                    println!("[keyboard] Key pressed: {:?}", key);
-                                    tx.send(InputEvent::KeyPressed(key.code())).unwrap();
-                                }
-                                0 => {
-                                    println!("[keyboard] Key released: {:?}", key);
-                                    tx.send(InputEvent::KeyReleased(key.code())).unwrap();
-                                }
-                                _ => {}
-                            }
-                        }
-                    }
-                }
-            }
-            Err(e) => {
-                eprintln!("[keyboard] Error fetching events: {}", e);
-                break;
-            }
-        }
-    });
-    Ok(())
-}
-
 pub fn find_touch_device() -> Result<Device> {
     for i in 0..20 {
         let path = format!("/dev/input/event{}", i);
         if let Ok(device) = Device::open(&path) {
             if matches!(device.name(), Some("Apple Inc. Apple T1 Controller Touchpad") | Some("Apple Inc. Touch Bar Display Touchpad")) {
-                println!("[touch] Found touch device at {}", path);
+                log_info!("[touch] Found touch device at {}", path);
                 return Ok(device);
             }
         }
@@ -93,55 +87,218 @@ pub fn find_touch_device() -> Result<Device> {
     Err(anyhow!("Could not find a suitable touch device."))
 }
 
-pub fn start_touch_handler(tx: Sender<InputEvent>) -> Result<()> {
-    let mut device = find_touch_device()?;
-    thread::spawn(move || {
-        let mut events_packet = Vec::new();
+// struct input_event as the kernel hands it out on 64-bit targets
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct RawEvent {
+    tv_sec: i64,
+    tv_usec: i64,
+    kind: u16,
+    code: u16,
+    value: i32,
+}
+
+const EV_SYN: u16 = 0x00;
+const EV_KEY: u16 = 0x01;
+const EV_ABS: u16 = 0x03;
+const SYN_REPORT: u16 = 0;
+const SYN_DROPPED: u16 = 3;
+const EVENT_BUFFER_LEN: usize = 64;
+
+// What one touch frame (everything up to a SYN_REPORT) said.
+#[derive(Default)]
+struct TouchFrame {
+    touch: Option<i32>,
+    x: Option<i32>,
+    // after SYN_DROPPED the rest of the frame is garbage
+    dropped: bool,
+}
+
+impl TouchFrame {
+    fn feed(&mut self, ev: &RawEvent) -> Option<TouchEvent> {
+        match (ev.kind, ev.code) {
+            (EV_KEY, code) if code == Key::BTN_TOUCH.code() => self.touch = Some(ev.value),
+            (EV_ABS, code) if code == AbsoluteAxisType::ABS_X.0 => self.x = Some(ev.value),
+            (EV_SYN, SYN_DROPPED) => self.dropped = true,
+            (EV_SYN, SYN_REPORT) => {
+                let frame = std::mem::take(self);
+                if frame.dropped {
+                    return None;
+                }
+                return match (frame.touch, frame.x) {
+                    (Some(1), Some(x)) => Some(TouchEvent::Down(x as f64)),
+                    (Some(1), None) => None,
+                    (Some(_), _) => Some(TouchEvent::Up),
+                    (None, Some(x)) => Some(TouchEvent::Motion(x as f64)),
+                    (None, None) => None,
+                };
+            }
+            _ => {}
+        }
+        None
+    }
+}
+
+impl RawEvent {
+    // When the kernel saw the event; devices are switched to CLOCK_MONOTONIC for this.
+    fn time(&self) -> Instant {
+        latency::from_monotonic(Duration::new(self.tv_sec as u64, self.tv_usec as u32 * 1000))
+    }
+}
+
+fn key_event(ev: &RawEvent) -> Option<InputEvent> {
+    if ev.kind != EV_KEY {
+        return None;
+    }
+    match (ev.code == Key::KEY_FN.code(), ev.value) {
+        (true, 1) => Some(InputEvent::FnKeyPressed),
+        (true, 0) => Some(InputEvent::FnKeyReleased),
+        (false, 1) => Some(InputEvent::KeyPressed(ev.code)),
+        (false, 0) => Some(InputEvent::KeyReleased(ev.code)),
+        _ => None,
+    }
+}
+
+// Decodes recorded raw events exactly like the reader thread does.
+#[derive(Default)]
+pub struct ReplayDecoder {
+    frame: TouchFrame,
+}
+
+impl ReplayDecoder {
+    pub fn touch(&mut self, kind: u16, code: u16, value: i32) -> Option<InputEvent> {
+        self.frame.feed(&RawEvent { kind, code, value, ..Default::default() }).map(InputEvent::Touch)
+    }
+
+    pub fn keyboard(&self, kind: u16, code: u16, value: i32) -> Option<InputEvent> {
+        key_event(&RawEvent { kind, code, value, ..Default::default() })
+    }
+}
+
+// Reads whatever the device has queued into `buf`; returns how many events that was.
+fn read_events(fd: RawFd, buf: &mut [RawEvent; EVENT_BUFFER_LEN]) -> Result<usize> {
+    let bytes = unsafe {
+        std::slice::from_raw_parts_mut(buf.as_mut_ptr() as *mut u8, std::mem::size_of_val(buf))
+    };
+    match read(fd, bytes) {
+        Ok(len) => Ok(len / std::mem::size_of::<RawEvent>()),
+        Err(Errno::EAGAIN) => Ok(0),
+        Err(e) => Err(e.into()),
+    }
+}
+
+// _IOW('E', 0xa0, int)
+const EVIOCSCLOCKID: u32 = 0x400445a0;
+
+// Makes reads nonblocking and event timestamps comparable with Instant.
+fn prepare_device(device: &Device) -> Result<()> {
+    fcntl(device.as_raw_fd(), FcntlArg::F_SETFL(OFlag::O_NONBLOCK))?;
+    let clock: libc::c_int = libc::CLOCK_MONOTONIC;
+    if unsafe { libc::ioctl(device.as_raw_fd(), EVIOCSCLOCKID as _, &clock) } < 0 {
+        return Err(std::io::Error::last_os_error().into());
+    }
+    Ok(())
+}
+
+// Drains a device into `buf` and hands every decoded event to `handle`. Returns Err
+// once the device has gone away.
+fn drain_device(device: &Device, buf: &mut [RawEvent; EVENT_BUFFER_LEN], mut handle: impl FnMut(&RawEvent) -> Result<()>) -> Result<()> {
+    loop {
+        let count = read_events(device.as_raw_fd(), buf)?;
+        for ev in &buf[..count] {
+            handle(ev)?;
+        }
+        if count < EVENT_BUFFER_LEN {
+            return Ok(());
+        }
+    }
+}
+
+// One thread serves both the Touch Bar digitizer and the keyboard: it polls the two
+// nonblocking device fds and decodes events straight out of a fixed buffer. A device
+// that disappears (USB reset, suspend) is dropped and looked for again whenever the
+// kernel reports a new input device.
+pub fn start_input_reader(tx: Sender<AppEvent>, keyboard: Device) -> Result<()> {
+    let mut monitor = Monitor::new("input")?;
+    let mut touch = Some(find_touch_device()?);
+    let mut keyboard = Some(keyboard);
+    for device in touch.iter().chain(keyboard.iter()) {
+        prepare_device(device)?;
+    }
+
+    thread::spawn(move || -> Result<()> {
+        let mut buf = [RawEvent::default(); EVENT_BUFFER_LEN];
+        let mut frame = TouchFrame::default();
+        let mut is_touching = false;
         loop {
-            match device.fetch_events() {
-                Ok(events) => {
-                    for ev in events {
-                        let is_syn_report = ev.kind() == InputEventKind::Synchronization(evdev::Synchronization::SYN_REPORT);
-                        events_packet.push(ev);
-
-                        if is_syn_report {
-                            let mut x_coord = None;
-                            let mut touch_event = None;
-
-                            for packet_ev in &events_packet {
-                                match packet_ev.kind() {
-                                    InputEventKind::Key(key) if key.code() == Key::BTN_TOUCH.code() => {
-                                        touch_event = Some(packet_ev.value());
-                                    }
-                                    InputEventKind::AbsAxis(axis) if axis == AbsoluteAxisType::ABS_X => {
-                                        x_coord = Some(packet_ev.value());
-                                    }
-                                    _ => {}
-                                }
-                            }
-
-                            if let Some(value) = touch_event {
-                                if value == 1 {
-                                    if let Some(x) = x_coord {
-                                        println!("[touch] Touch down at x: {}", x);
-                                        tx.send(InputEvent::Touch(TouchEvent::Down(x as f64))).unwrap();
-                                    }
-                                } else {
-                                    println!("[touch] Touch up");
-                                    tx.send(InputEvent::Touch(TouchEvent::Up)).unwrap();
-                                }
-                            } else if let Some(x) = x_coord {
-                                println!("[touch] Touch motion at x: {}", x);
-                                tx.send(InputEvent::Touch(TouchEvent::Motion(x as f64))).unwrap();
-                            }
-
-                            events_packet.clear();
-                        }
+            let (touch_ready, keyboard_ready, monitor_ready) = {
+                // a missing device's slot polls the monitor for nothing, keeping the set fixed
+                let slot = |device: &Option<Device>| match device {
+                    Some(device) => (unsafe { BorrowedFd::borrow_raw(device.as_raw_fd()) }, PollFlags::POLLIN),
+                    None => (monitor.as_fd(), PollFlags::empty()),
+                };
+                let (touch_fd, touch_events) = slot(&touch);
+                let (keyboard_fd, keyboard_events) = slot(&keyboard);
+                let monitor_fd = monitor.as_fd();
+                let mut fds = [
+                    PollFd::new(&touch_fd, touch_events),
+                    PollFd::new(&keyboard_fd, keyboard_events),
+                    PollFd::new(&monitor_fd, PollFlags::POLLIN),
+                ];
+                poll(&mut fds, -1)?;
+                let ready = |fd: &PollFd| fd.revents().map_or(false, |r| !r.is_empty());
+                (touch.is_some() && ready(&fds[0]), keyboard.is_some() && ready(&fds[1]), ready(&fds[2]))
+            };
+
+            if touch_ready {
+                let result = drain_device(touch.as_ref().unwrap(), &mut buf, |ev| {
+                    if record::is_recording() {
+                        record::touch(ev.time(), ev.kind, ev.code, ev.value);
+                    }
+                    if let Some(event) = frame.feed(ev) {
+                        log_trace!("[touch] {:?}", event);
+                        is_touching = !matches!(event, TouchEvent::Up);
+                        tx.send(AppEvent::Input(InputEvent::Touch(event), ev.time()))?;
                     }
+                    Ok(())
+                });
+                if let Err(e) = result {
+                    log_warn!("[touch] Lost touch device: {}", e);
+                    touch = None;
+                    frame = TouchFrame::default();
+                    // don't leave a press or drag hanging
+                    if is_touching {
+                        is_touching = false;
+                        tx.send(AppEvent::Input(InputEvent::Touch(TouchEvent::Up), Instant::now()))?;
+                    }
+                }
+            }
+
+            if keyboard_ready {
+                let result = drain_device(keyboard.as_ref().unwrap(), &mut buf, |ev| {
+                    if record::is_recording() {
+                        record::keyboard(ev.time(), ev.kind, ev.code, ev.value);
+                    }
+                    if let Some(event) = key_event(ev) {
+                        log_trace!("[keyboard] {:?}", event);
+                        tx.send(AppEvent::Input(event, ev.time()))?;
+                    }
+                    Ok(())
+                });
+                if let Err(e) = result {
+                    log_warn!("[keyboard] Lost keyboard device: {}", e);
+                    keyboard = None;
+                }
+            }
+
+            record::flush();
+
+            if monitor_ready && monitor.drain()? {
+                if touch.is_none() {
+                    touch = find_touch_device().ok().filter(|device| prepare_device(device).is_ok());
                 }
-                Err(e) => {
-                    eprintln!("[touch] Error fetching events: {}", e);
-                    break;
+                if keyboard.is_none() {
+                    keyboard = find_keyboard_features().ok().map(|features| features.device).filter(|device| prepare_device(device).is_ok());
                 }
             }
         }
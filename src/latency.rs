@@ -0,0 +1,115 @@
+// Touch-to-photon tracing. An input keeps the kernel's timestamp from evdev through the
+// main loop and into the snapshot it changes; the render thread finishes the trace once
+// the frame carrying it has been flipped onto the panel.
+
+use crate::stats::FrameStats;
+use std::fs::{File, OpenOptions};
+use std::io::Write;
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+// When set, every finished trace is appended to this file as a line of microseconds.
+const TRACE_FILE_VAR: &str = "DFR_LATENCY_TRACE";
+
+// Converts a CLOCK_MONOTONIC timestamp from the kernel (evdev, DRM events) to an Instant,
+// which uses the same clock.
+pub fn from_monotonic(timestamp: Duration) -> Instant {
+    let now = Instant::now();
+    let mut ts = libc::timespec { tv_sec: 0, tv_nsec: 0 };
+    unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+    let clock_now = Duration::new(ts.tv_sec as u64, ts.tv_nsec as u32);
+    now.checked_sub(clock_now.saturating_sub(timestamp)).unwrap_or(now)
+}
+
+// An input that changed the state, on its way to the screen.
+#[derive(Clone, Copy, Debug)]
+pub struct InputTrace {
+    pub kind: &'static str,
+    // when the kernel timestamped the event
+    pub input: Instant,
+    // when the main loop took it off the event channel
+    pub dequeued: Instant,
+    // when the snapshot showing its effect was published
+    pub published: Option<Instant>,
+}
+
+// An input trace, plus what the render thread did with the frame that first shows it.
+pub struct FrameTrace {
+    input: InputTrace,
+    picked_up: Instant,
+    presented: Instant,
+}
+
+impl FrameTrace {
+    pub fn new(input: InputTrace, picked_up: Instant, presented: Instant) -> Self {
+        FrameTrace { input, picked_up, presented }
+    }
+}
+
+pub struct LatencyRecorder {
+    trace_file: Option<File>,
+}
+
+impl LatencyRecorder {
+    pub fn new() -> Self {
+        let trace_file = std::env::var_os(TRACE_FILE_VAR).and_then(|path| {
+            match OpenOptions::new().create(true).append(true).open(&path) {
+                Ok(file) => Some(file),
+                Err(e) => {
+                    log_warn!("[latency] Cannot open {}: {}", path.to_string_lossy(), e);
+                    None
+                }
+            }
+        });
+        LatencyRecorder { trace_file }
+    }
+
+    // `on_screen` is when the frame was flipped, if the presenter knows.
+    pub fn finish(&mut self, trace: FrameTrace, on_screen: Option<Instant>, stats: &Mutex<FrameStats>) {
+        let input = trace.input;
+        let published = input.published.unwrap_or(input.dequeued);
+        // a flip from before this frame was queued belongs to an older frame
+        let on_screen = on_screen.filter(|t| *t >= trace.presented).unwrap_or(trace.presented);
+        let breakdown = LatencyBreakdown {
+            input: input.dequeued.saturating_duration_since(input.input),
+            state: published.saturating_duration_since(input.dequeued),
+            handoff: trace.picked_up.saturating_duration_since(published),
+            render: trace.presented.saturating_duration_since(trace.picked_up),
+            scanout: on_screen.saturating_duration_since(trace.presented),
+            total: on_screen.saturating_duration_since(input.input),
+        };
+        stats.lock().unwrap().record_latency(&breakdown);
+
+        if let Some(file) = &mut self.trace_file {
+            let line = format!(
+                "{} total={} input={} state={} handoff={} render={} scanout={}\n",
+                input.kind,
+                breakdown.total.as_micros(),
+                breakdown.input.as_micros(),
+                breakdown.state.as_micros(),
+                breakdown.handoff.as_micros(),
+                breakdown.render.as_micros(),
+                breakdown.scanout.as_micros(),
+            );
+            if let Err(e) = file.write_all(line.as_bytes()) {
+                log_warn!("[latency] Stopped writing traces: {}", e);
+                self.trace_file = None;
+            }
+        }
+    }
+}
+
+// Where the time between a touch and its frame on the panel went.
+pub struct LatencyBreakdown {
+    // kernel to main loop: the input thread and the event channel
+    pub input: Duration,
+    // handling the event and publishing a snapshot
+    pub state: Duration,
+    // snapshot published to the render thread picking it up
+    pub handoff: Duration,
+    // drawing and queueing the frame
+    pub render: Duration,
+    // queued frame to flip completion, which covers the USB transfer
+    pub scanout: Duration,
+    pub total: Duration,
+}
@@ -0,0 +1,285 @@
+// Logging that costs the input and render paths no locks and no syscalls. A message is
+// formatted straight into a fixed slot of a ring buffer; a background thread prints what
+// has queued up every DRAIN_INTERVAL, and the ring keeps the last RING_LEN messages for
+// post-mortem inspection with `dfr_daemon dump`.
+//
+// Messages above STATIC_MAX_LEVEL are compiled out; the rest are gated at runtime by
+// DFR_LOG (error, warn, info, debug or trace; info by default).
+
+use anyhow::Result;
+use std::fmt::{self, Write as _};
+use std::fs;
+use std::io::{self, Write};
+use std::os::unix::fs::PermissionsExt;
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::sync::atomic::{fence, AtomicU32, AtomicU64, AtomicU8, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::thread;
+use std::time::{Duration, Instant};
+
+pub const ERROR: u8 = 1;
+pub const WARN: u8 = 2;
+pub const INFO: u8 = 3;
+pub const DEBUG: u8 = 4;
+pub const TRACE: u8 = 5;
+
+pub const STATIC_MAX_LEVEL: u8 = if cfg!(feature = "trace-log") { TRACE } else { DEBUG };
+
+pub const DUMP_SOCKET_PATH: &str = "/run/dfr_daemon.log";
+const RING_LEN: usize = 1024;
+// longer messages are cut off
+const MESSAGE_WORDS: usize = 16;
+const MESSAGE_LEN: usize = MESSAGE_WORDS * 8;
+const DRAIN_INTERVAL: Duration = Duration::from_millis(50);
+
+static LEVEL: AtomicU8 = AtomicU8::new(INFO);
+static START: OnceLock<Instant> = OnceLock::new();
+
+// A seqlock: `seq` is odd while a writer fills the slot and 2 * (position + 1) once
+// message number `position` is complete. Everything is atomic, so a reader racing a
+// writer sees a mismatched sequence rather than undefined behaviour.
+struct Slot {
+    seq: AtomicU64,
+    micros: AtomicU64,
+    // level << 8 | length
+    meta: AtomicU32,
+    text: [AtomicU64; MESSAGE_WORDS],
+}
+
+impl Slot {
+    const EMPTY: Slot = Slot {
+        seq: AtomicU64::new(0),
+        micros: AtomicU64::new(0),
+        meta: AtomicU32::new(0),
+        text: [const { AtomicU64::new(0) }; MESSAGE_WORDS],
+    };
+}
+
+struct Ring {
+    head: AtomicU64,
+    slots: [Slot; RING_LEN],
+}
+
+static RING: Ring = Ring { head: AtomicU64::new(0), slots: [Slot::EMPTY; RING_LEN] };
+
+struct Entry {
+    level: u8,
+    micros: u64,
+    text: String,
+}
+
+enum Read {
+    Ready(Entry),
+    // the writer hasn't finished yet
+    Pending,
+    // a newer message took the slot
+    Overwritten,
+}
+
+struct MessageBuf {
+    bytes: [u8; MESSAGE_LEN],
+    len: usize,
+}
+
+impl fmt::Write for MessageBuf {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        let take = s.len().min(MESSAGE_LEN - self.len);
+        self.bytes[self.len..self.len + take].copy_from_slice(&s.as_bytes()[..take]);
+        self.len += take;
+        Ok(())
+    }
+}
+
+pub fn enabled(level: u8) -> bool {
+    level <= LEVEL.load(Ordering::Relaxed)
+}
+
+pub fn push(level: u8, args: fmt::Arguments) {
+    let mut message = MessageBuf { bytes: [0; MESSAGE_LEN], len: 0 };
+    let _ = message.write_fmt(args);
+    let micros = START.get().map_or(0, |start| start.elapsed().as_micros() as u64);
+
+    let position = RING.head.fetch_add(1, Ordering::Relaxed);
+    let slot = &RING.slots[(position % RING_LEN as u64) as usize];
+    slot.seq.store(position * 2 + 1, Ordering::Relaxed);
+    fence(Ordering::Release);
+    slot.micros.store(micros, Ordering::Relaxed);
+    slot.meta.store((level as u32) << 8 | message.len as u32, Ordering::Relaxed);
+    for (word, chunk) in slot.text.iter().zip(message.bytes.chunks_exact(8)) {
+        word.store(u64::from_ne_bytes(chunk.try_into().unwrap()), Ordering::Relaxed);
+    }
+    slot.seq.store(position * 2 + 2, Ordering::Release);
+}
+
+fn read(position: u64) -> Read {
+    let slot = &RING.slots[(position % RING_LEN as u64) as usize];
+    let done = position * 2 + 2;
+    let seq = slot.seq.load(Ordering::Acquire);
+    if seq < done {
+        return Read::Pending;
+    }
+    if seq > done {
+        return Read::Overwritten;
+    }
+    let micros = slot.micros.load(Ordering::Relaxed);
+    let meta = slot.meta.load(Ordering::Relaxed);
+    let mut bytes = [0u8; MESSAGE_LEN];
+    for (chunk, word) in bytes.chunks_exact_mut(8).zip(&slot.text) {
+        chunk.copy_from_slice(&word.load(Ordering::Relaxed).to_ne_bytes());
+    }
+    fence(Ordering::Acquire);
+    if slot.seq.load(Ordering::Relaxed) != done {
+        return Read::Overwritten;
+    }
+    let len = (meta & 0xff) as usize;
+    Read::Ready(Entry { level: (meta >> 8) as u8, micros, text: String::from_utf8_lossy(&bytes[..len]).into_owned() })
+}
+
+// Position of the next message the printing side hasn't seen.
+static DRAINED: Mutex<u64> = Mutex::new(0);
+
+// Prints everything queued so far: warnings and errors to stderr, the rest to stdout,
+// one write each.
+pub fn flush() {
+    let mut next = DRAINED.lock().unwrap();
+    let head = RING.head.load(Ordering::Acquire);
+    let mut dropped = head.saturating_sub(RING_LEN as u64).saturating_sub(*next);
+    *next += dropped;
+    let (mut out, mut err) = (String::new(), String::new());
+    while *next < head {
+        match read(*next) {
+            Read::Ready(entry) => {
+                let target = if entry.level <= WARN { &mut err } else { &mut out };
+                target.push_str(&entry.text);
+                target.push('\n');
+            }
+            Read::Pending => break,
+            Read::Overwritten => dropped += 1,
+        }
+        *next += 1;
+    }
+    if dropped > 0 {
+        let _ = writeln!(err, "[log] {} messages dropped", dropped);
+    }
+    if !out.is_empty() {
+        let _ = io::stdout().write_all(out.as_bytes());
+    }
+    if !err.is_empty() {
+        let _ = io::stderr().write_all(err.as_bytes());
+    }
+}
+
+fn level_name(level: u8) -> &'static str {
+    match level {
+        ERROR => "ERROR",
+        WARN => "WARN",
+        INFO => "INFO",
+        DEBUG => "DEBUG",
+        _ => "TRACE",
+    }
+}
+
+fn parse_level(name: &str) -> Option<u8> {
+    match name.to_ascii_lowercase().as_str() {
+        "error" => Some(ERROR),
+        "warn" => Some(WARN),
+        "info" => Some(INFO),
+        "debug" => Some(DEBUG),
+        "trace" => Some(TRACE),
+        _ => None,
+    }
+}
+
+// The messages still in the ring, oldest first, with time since startup and level.
+fn dump() -> String {
+    let head = RING.head.load(Ordering::Acquire);
+    let mut out = String::new();
+    for position in head.saturating_sub(RING_LEN as u64)..head {
+        if let Read::Ready(entry) = read(position) {
+            let _ = writeln!(
+                out,
+                "{:>6}.{:06} {:<5} {}",
+                entry.micros / 1_000_000,
+                entry.micros % 1_000_000,
+                level_name(entry.level),
+                entry.text
+            );
+        }
+    }
+    out
+}
+
+// Prints whatever is still queued when dropped; main holds one so the last messages
+// before an exit, or before the error it returns, are not lost.
+pub struct FlushGuard;
+
+impl Drop for FlushGuard {
+    fn drop(&mut self) {
+        flush();
+    }
+}
+
+// Starts the clock and the printing thread. Messages logged before this are kept and
+// printed once it runs, with a time of zero.
+#[must_use]
+pub fn init() -> FlushGuard {
+    START.get_or_init(Instant::now);
+    if let Some(name) = std::env::var_os("DFR_LOG") {
+        match name.to_str().and_then(parse_level) {
+            Some(level) => LEVEL.store(level, Ordering::Relaxed),
+            None => eprintln!("[log] Unknown level {:?} in DFR_LOG", name),
+        }
+    }
+    thread::spawn(|| loop {
+        thread::sleep(DRAIN_INTERVAL);
+        flush();
+    });
+    // a panic message goes straight to stderr; get ours out first so they read in order
+    let default_hook = std::panic::take_hook();
+    std::panic::set_hook(Box::new(move |info| {
+        flush();
+        default_hook(info);
+    }));
+    FlushGuard
+}
+
+// Serves the ring's contents to every connection on DUMP_SOCKET_PATH.
+pub fn start_dump_server() -> Result<()> {
+    let _ = fs::remove_file(DUMP_SOCKET_PATH);
+    let listener = UnixListener::bind(DUMP_SOCKET_PATH)?;
+    fs::set_permissions(DUMP_SOCKET_PATH, fs::Permissions::from_mode(0o600))?;
+    thread::spawn(move || {
+        for stream in listener.incoming() {
+            let Ok(mut stream) = stream else { continue };
+            let _ = stream.write_all(dump().as_bytes());
+        }
+    });
+    Ok(())
+}
+
+// `dfr_daemon dump`: prints the running daemon's recent log.
+pub fn print_dump() -> Result<()> {
+    let mut stream = UnixStream::connect(DUMP_SOCKET_PATH)?;
+    io::copy(&mut stream, &mut io::stdout())?;
+    Ok(())
+}
+
+#[allow(unused_macros)]
+macro_rules! log_at {
+    ($level:expr, $($arg:tt)+) => {
+        if $level <= $crate::logging::STATIC_MAX_LEVEL && $crate::logging::enabled($level) {
+            $crate::logging::push($level, format_args!($($arg)+));
+        }
+    };
+}
+
+#[allow(unused_macros)]
+macro_rules! log_error { ($($arg:tt)+) => { log_at!($crate::logging::ERROR, $($arg)+) }; }
+#[allow(unused_macros)]
+macro_rules! log_warn { ($($arg:tt)+) => { log_at!($crate::logging::WARN, $($arg)+) }; }
+#[allow(unused_macros)]
+macro_rules! log_info { ($($arg:tt)+) => { log_at!($crate::logging::INFO, $($arg)+) }; }
+#[allow(unused_macros)]
+macro_rules! log_debug { ($($arg:tt)+) => { log_at!($crate::logging::DEBUG, $($arg)+) }; }
+#[allow(unused_macros)]
+macro_rules! log_trace { ($($arg:tt)+) => { log_at!($crate::logging::TRACE, $($arg)+) }; }
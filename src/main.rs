@@ -1,5 +1,8 @@
+#[macro_use]
+mod logging;
 mod app;
 mod config;
+mod icons;
 mod dynamic;
 mod input;
 mod renderer;
@@ -7,336 +10,374 @@ mod ui;
 mod virtual_keyboard;
 mod backlight;
 mod volume;
+mod pulse;
 mod screenshot;
 mod media;
-
-use anyhow::Result;
-use app::AppState;
-use cairo::{Format, ImageSurface};
-
-use crate::dynamic::DynamicManager;
-use std::sync::{mpsc, Arc, Mutex, Condvar};
+mod mpris;
+mod sprite;
+mod triple_buffer;
+mod hotplug;
+mod clock;
+mod reload;
+mod offscreen;
+mod bench;
+mod stats;
+mod latency;
+mod record;
+mod replay;
+
+use anyhow::{anyhow, Result};
+use app::{AppEvent, AppState, RenderSnapshot};
+use hotplug::Monitor;
+use renderer::Presenter;
+use stats::{FrameStats, Stage};
+use latency::{FrameTrace, InputTrace, LatencyRecorder};
+use triple_buffer::{triple_buffer, Reader};
+use std::path::Path;
+use std::sync::mpsc::{self, RecvTimeoutError};
+use std::sync::{Arc, Mutex};
 use std::thread;
 use std::time::{Duration, Instant};
 use backlight::Backlight;
 use volume::Volume;
 use crate::ui::Page;
 use crate::media::MediaInfo;
-use std::fs;
-use std::io::{BufRead, BufReader};
-use std::path::Path;
-use nix::unistd;
-use nix::sys::stat;
-use std::os::unix::fs::PermissionsExt;
 
-const PIPE_PATH: &str = "/tmp/ndfr-media.pipe";
+const VOLUME_WRITE_INTERVAL: Duration = Duration::from_millis(100);
+const DRM_RETRY_INTERVAL: Duration = Duration::from_secs(2);
+
+// Draws snapshots on `drm` until the backend fails.
+fn render_frames<P: Presenter>(
+    drm: &mut P,
+    snapshot_reader: &mut Reader<RenderSnapshot>,
+    stats: &Mutex<FrameStats>,
+    latency: &mut LatencyRecorder,
+) -> Result<()> {
+    let (drm_w, _) = drm.get_dimensions();
+    let mut surfaces = drm.surfaces()?;
+
+    const TARGET_FPS: u64 = 60;
+    const FRAME_DURATION: Duration = Duration::from_millis(1000 / TARGET_FPS);
+
+    // set while a playing track is on screen, so the playhead keeps moving between media updates.
+    let mut playhead_redraw: Option<Duration> = None;
+    let mut damage_tracker = renderer::DamageTracker::new(drm_w);
+    // a fresh backend shows nothing yet, so the current snapshot is drawn straight away
+    let mut is_first_frame = true;
+    // an input whose snapshot hasn't been drawn yet, and a drawn one not yet on screen
+    let mut undrawn_input: Option<InputTrace> = None;
+    let mut in_flight: Option<FrameTrace> = None;
+
+    loop {
+        let mut frame_start = Instant::now();
+        let mut fresh = snapshot_reader.update();
+        if !fresh && !is_first_frame && !snapshot_reader.get().map_or(false, |s| s.is_animating(Instant::now())) {
+            // nothing else to draw, so see the traced frame onto the panel before sleeping
+            if let Some(trace) = in_flight.take() {
+                drm.wait_idle()?;
+                latency.finish(trace, drm.last_flip(), stats);
+            }
+            match playhead_redraw {
+                Some(timeout) => thread::park_timeout(timeout),
+                None => thread::park(),
+            }
+            frame_start = Instant::now();
+            fresh = snapshot_reader.update();
+        }
+        let Some(snapshot) = snapshot_reader.get() else {
+            thread::park();
+            continue;
+        };
+        if fresh {
+            // snapshots that were never drawn are shown by this one as well
+            undrawn_input = undrawn_input.or(snapshot.input);
+        }
+        is_first_frame = false;
+        let anim_progress = snapshot.animation_progress(frame_start);
+        let damage_start = Instant::now();
+
+        let damage = damage_tracker.track(&snapshot.page, &snapshot.gesture, snapshot.dynamic_content.as_ref(), anim_progress);
+        let acquire_start = Instant::now();
+        if damage.as_ref().map_or(true, |rects| !rects.is_empty()) {
+            let (back, repaint) = drm.begin_frame(damage.as_deref())?;
+            let draw_start = Instant::now();
+            let surface = &mut surfaces[back];
+            renderer::draw_ui(
+                surface,
+                &snapshot.page,
+                &snapshot.gesture,
+                snapshot.dynamic_content.as_ref().map(|(d, r)| (d, r)),
+                              anim_progress,
+                              frame_start,
+                              false,
+                              repaint.as_deref(),
+            )?;
+            let present_start = Instant::now();
+            // waits for the previous page flip, so animation frames are paced by vblank
+            drm.present(surface, repaint.as_deref(), damage.as_deref())?;
+
+            // presenting waited for the previous frame's flip
+            if let Some(trace) = in_flight.take() {
+                latency.finish(trace, drm.last_flip(), stats);
+            }
+            if let Some(input) = undrawn_input.take() {
+                in_flight = Some(FrameTrace::new(input, frame_start, Instant::now()));
+            }
+
+            let timings = drm.present_timings();
+            let mut stats = stats.lock().unwrap();
+            stats.record(Stage::Snapshot, damage_start - frame_start);
+            stats.record(Stage::Damage, acquire_start - damage_start);
+            stats.record(Stage::Acquire, draw_start - acquire_start);
+            stats.record(Stage::Draw, present_start - draw_start);
+            stats.record(Stage::Copy, timings.copy);
+            stats.record(Stage::FlipWait, timings.flip_wait);
+            stats.record(Stage::Commit, timings.commit);
+            let frame_time = frame_start.elapsed();
+            let busy = frame_time.saturating_sub(timings.flip_wait);
+            stats.frame_done(frame_time, busy > FRAME_DURATION);
+        } else {
+            stats.lock().unwrap().idle_wakeup();
+        }
+
+        playhead_redraw = match (&snapshot.dynamic_content, &snapshot.gesture) {
+            (_, app::Gesture::ScrubberDrag { .. }) => None,
+            (Some((drawable, bounds)), _) => drawable.next_redraw(bounds).map(|d| d.max(FRAME_DURATION)),
+            _ => None,
+        };
+    }
+}
 
 fn main() -> Result<()> {
-    let pipe_path = Path::new(PIPE_PATH);
-    if pipe_path.exists() {
-        fs::remove_file(pipe_path)?;
+    let _log = logging::init();
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    let mut record_path = None;
+    match args.first().map(String::as_str) {
+        Some("dump") => return logging::print_dump(),
+        Some("bench") => {
+            let frames = match args.get(1) {
+                Some(frames) => frames.parse()?,
+                None => bench::DEFAULT_FRAMES,
+            };
+            return bench::run(frames);
+        }
+        Some("replay") => {
+            let path = args.get(1).ok_or(anyhow!("Usage: dfr_daemon replay <file> [--fast]"))?;
+            return replay::run(Path::new(path), args.iter().any(|arg| arg == "--fast"));
+        }
+        Some("record") => {
+            record_path = Some(args.get(1).ok_or(anyhow!("Usage: dfr_daemon record <file>"))?.clone());
+        }
+        _ => {}
     }
-    unistd::mkfifo(pipe_path, stat::Mode::S_IRWXU)?;
-    fs::set_permissions(pipe_path, fs::Permissions::from_mode(0o666))?;
-    println!("[main] Created media pipe at {}", PIPE_PATH);
 
     let keyboard_features = input::find_keyboard_features()?;
     let has_physical_esc = keyboard_features.has_physical_esc;
     let keyboard_device = keyboard_features.device;
+    if let Some(path) = record_path {
+        record::start(Path::new(&path), has_physical_esc)?;
+    }
 
-    let mut drm = renderer::DrmBackend::new()?;
+    let drm = renderer::DrmBackend::new()?;
     let (physical_width, physical_height) = drm.get_dimensions();
     let (logical_width, logical_height) = (physical_height, physical_width);
 
-    let app_state = Arc::new((Mutex::new(AppState::new(logical_width, logical_height, has_physical_esc, &Vec::new())?), Condvar::new()));
-    let backlight = Arc::new(Mutex::new(Backlight::new()?));
-    let volume = Arc::new(Mutex::new(Volume::new()?));
+    icons::init(logical_height)?;
+
+    let mut state = AppState::new(logical_width, logical_height, has_physical_esc, &Vec::new(), Instant::now())?;
+    let backlight = Backlight::new()?;
+    let mut volume = Volume::new()?;
 
     // shared state for the latest media info
     let latest_media_info = Arc::new(Mutex::new(Vec::<MediaInfo>::new()));
 
     let (tx, rx) = mpsc::channel();
-    input::start_touch_handler(tx.clone())?;
-    input::start_keyboard_handler(tx, keyboard_device)?;
+    input::start_input_reader(tx.clone(), keyboard_device)?;
 
     let mut uinput = virtual_keyboard::create_virtual_keyboard()?;
 
-    let renderer_state = Arc::clone(&app_state);
+    // The render thread only ever sees snapshots: the main loop publishes a new one whenever
+    // the state changes and unparks it, and neither side waits on the other.
+    let (mut snapshot_writer, mut snapshot_reader) = triple_buffer::<RenderSnapshot>();
+    if let Err(e) = logging::start_dump_server() {
+        log_warn!("[log] Log dumps unavailable: {}", e);
+    }
+    let frame_stats = Arc::new(Mutex::new(FrameStats::new()));
+    if let Err(e) = stats::start_stats_server(Arc::clone(&frame_stats)) {
+        log_warn!("[stats] Frame stats unavailable: {}", e);
+    }
     let render_thread_handle = thread::spawn(move || -> Result<()> {
-        let (drm_w, drm_h) = drm.get_dimensions();
-        let mut surface = ImageSurface::create(Format::ARgb32, drm_w, drm_h)?;
-        let (lock, cvar) = &*renderer_state;
-
-        const TARGET_FPS: u64 = 60;
-        const FRAME_DURATION: Duration = Duration::from_millis(1000 / TARGET_FPS);
-
+        // the display drops off the bus on USB resets and some resumes; keep the last
+        // snapshot and bring a fresh backend up once the card is back
+        let mut monitor = Monitor::new("drm")?;
+        let mut drm = Some(drm);
+        let mut latency = LatencyRecorder::new();
         loop {
-            let frame_start = Instant::now();
-
-            let (page_to_draw, gesture_to_draw, dynamic_content, anim_progress, is_still_animating) = {
-                let mut state = lock.lock().unwrap();
-
-                if !state.is_animating {
-                    state = cvar.wait_while(state, |s| !s.needs_redraw).unwrap();
-                }
-
-                state.update_animations();
-
-                let page = state.page.clone();
-                let gesture = state.gesture.clone();
-                let progress = state.get_animation_progress();
-                let is_animating = state.is_animating;
-
-                let dynamic_content = match &page {
-                    Page::Default(layout) if Arc::ptr_eq(layout, &state.default_layout) => {
-                        Some((state.dynamic_drawable.clone(), state.default_dynamic_area_bounds))
-                    }
-                    Page::MediaInfoShowing(_) | Page::MediaInfoHiding(_) => {
-                        Some((state.dynamic_drawable.clone(), state.default_dynamic_area_bounds))
+            let mut backend = match drm.take() {
+                Some(backend) => backend,
+                // a card coming back wakes us early; otherwise retry every couple of seconds
+                None => loop {
+                    monitor.wait(Some(DRM_RETRY_INTERVAL))?;
+                    monitor.drain()?;
+                    if let Ok(backend) = renderer::DrmBackend::new() {
+                        log_info!("[renderer] Display is back");
+                        break backend;
                     }
-                    _ => None,
-                };
-
-                if !is_animating {
-                    state.needs_redraw = false;
-                }
-
-                (page, gesture, dynamic_content, progress, is_animating)
+                },
             };
-
-            renderer::draw_ui(
-                &mut surface,
-                &page_to_draw,
-                &gesture_to_draw,
-                dynamic_content.as_ref().map(|(d, r)| (d, r)),
-                              anim_progress,
-                              false,
-            )?;
-            drm.present(&mut surface)?;
-
-            if is_still_animating {
-                let elapsed = frame_start.elapsed();
-                if elapsed < FRAME_DURATION {
-                    thread::sleep(FRAME_DURATION - elapsed);
-                }
-                cvar.notify_one();
+            if let Err(e) = render_frames(&mut backend, &mut snapshot_reader, &frame_stats, &mut latency) {
+                log_warn!("[renderer] Lost the display, waiting for it to come back: {}", e);
             }
         }
     });
+    let render_thread = render_thread_handle.thread().clone();
 
-    {
-        let (lock, cvar) = &*app_state;
-        let mut state = lock.lock().unwrap();
-        state.brightness_value = backlight.lock().unwrap().get_brightness()?;
-        state.volume_value = volume.lock().unwrap().get_volume()?;
-        state.needs_redraw = true;
-        cvar.notify_one();
-    }
+    state.brightness_value = backlight.get_brightness()?;
 
-    // the only job of this media pipe listener thread is to update the shared `latest_media_info` state.
-    let media_pipe_info = Arc::clone(&latest_media_info);
-    thread::spawn(move || {
-        println!("[media] Media pipe listener thread started.");
-        // ensures that if the pipe is closed and re-created, the listener will re-attach.
-        loop {
-            if let Ok(file) = fs::File::open(PIPE_PATH) {
-                let reader = BufReader::new(file);
-                println!("[media] Opened media pipe for reading.");
-                for line in reader.lines() {
-                    let line = match line {
-                        Ok(l) => l,
-                        Err(e) => {
-                            eprintln!("[media] Error reading from pipe: {}. Breaking to reopen.", e);
-                            break;
-                        }
-                    };
-
-                    if line.is_empty() {
-                        continue;
-                    }
+    clock::start_clock(tx.clone())?;
 
-                    let mut info_lock = media_pipe_info.lock().unwrap();
-                    match serde_json::from_str::<Vec<MediaInfo>>(&line) {
-                        Ok(media_info) => {
-                            *info_lock = media_info;
-                        },
-                        Err(e) => {
-                            if !line.trim().is_empty() && line != "[]" {
-                                eprintln!("[media] Failed to deserialize media info: '{}', line: '{}'", e, line);
-                            }
-                            *info_lock = Vec::new();
-                        }
-                    };
-                }
-            } else {
-                thread::sleep(Duration::from_secs(1));
-            }
-        }
-    });
+    // the MPRIS client keeps the shared `latest_media_info` state current and carries player commands.
+    let media_controller = mpris::start_mpris_client(Arc::clone(&latest_media_info), tx.clone())?;
 
-    let dynamic_updater_info = Arc::clone(&latest_media_info);
-    let dynamic_updater_state = Arc::clone(&app_state);
-    thread::spawn(move || {
-        loop {
-            thread::sleep(Duration::from_millis(200));
-
-            let (lock, cvar) = &*dynamic_updater_state;
-            let mut state = lock.lock().unwrap();
-
-
-            if let app::Gesture::ScrubberDrag { .. } = state.gesture {
-                drop(state);
-                continue;
-            }
-
-            let info_lock = dynamic_updater_info.lock().unwrap();
-
-            let mut layout_changed = false;
-
-            let new_drawable = if state.media_info_visible {
-                if !info_lock.is_empty() {
-                    DynamicManager::create_media_drawable(&info_lock, state.active_player_index, state.height)
-                } else {
-                    DynamicManager::create_clock_drawable()
-                }
-            } else {
-                DynamicManager::create_clock_drawable()
-            };
-
-            if !state.media_button_visible && !info_lock.is_empty() {
-                if let Ok((new_buttons, new_bounds)) = ui::create_default_layout(
-                    state.width, state.height, state.has_physical_esc, &info_lock
-                ) {
-                    state.default_layout = Arc::new(new_buttons);
-                    state.default_dynamic_area_bounds = new_bounds;
-                    state.media_button_visible = true;
-                    layout_changed = true;
-                } else {
-                    eprintln!("[main] Error: Failed to create layout with media button.");
-                }
-            } else if state.media_button_visible && info_lock.is_empty() {
-                let (new_buttons, new_bounds) = ui::create_default_layout(
-                    state.width, state.height, state.has_physical_esc, &Vec::new()
-                ).unwrap();
-                state.default_layout = Arc::new(new_buttons);
-                state.default_dynamic_area_bounds = new_bounds;
-                state.media_button_visible = false;
-                layout_changed = true;
-            }
+    state.build_layouts_in_background(tx.clone());
+    reload::start_resource_watcher(tx.clone(), logical_width, logical_height, has_physical_esc, Arc::clone(&latest_media_info))?;
 
-            if layout_changed {
-                if let Page::Default(_) = &state.page {
-                    state.page = Page::Default(Arc::clone(&state.default_layout));
-                }
-            }
-
-            if state.dynamic_drawable != new_drawable || layout_changed {
-                state.dynamic_drawable = new_drawable;
-                state.needs_redraw = true;
-                cvar.notify_one();
-            }
-        }
-    });
-
-
-    let timeout_check_state = Arc::clone(&app_state);
-    thread::spawn(move || {
+    // backends that change under us block in their own threads and report through the event channel.
+    let mut brightness_watcher = backlight.watcher()?;
+    let brightness_tx = tx.clone();
+    thread::spawn(move || -> Result<()> {
         loop {
-            thread::sleep(Duration::from_secs(1));
-            let (lock, cvar) = &*timeout_check_state;
-            let mut state = lock.lock().unwrap();
-            if state.control_strip_expanded && !state.is_animating && state.last_input_time.elapsed() > Duration::from_secs(5) {
-                println!("[app] No input for 5 seconds, closing control strip");
-                state.control_strip_expanded = false;
-                state.page = Page::ControlStripClosing(Arc::clone(&state.expanded_layout));
-                state.animation_start = Instant::now();
-                state.is_animating = true;
-                state.needs_redraw = true;
-                state.ignore_input = true;
-                cvar.notify_one();
-            }
+            brightness_tx.send(AppEvent::BrightnessChanged(brightness_watcher.wait()?))?;
         }
     });
 
-    let brightness_writer_state = Arc::clone(&app_state);
-    let brightness_writer_backlight = Arc::clone(&backlight);
+    let mut volume_watcher = volume.watcher()?;
+    let volume_tx = tx;
     thread::spawn(move || -> Result<()> {
-        let mut last_written_brightness = -1.0;
         loop {
-            thread::sleep(Duration::from_millis(100));
-            let state = brightness_writer_state.0.lock().unwrap();
-            let new_brightness = state.brightness_value;
-            drop(state);
-
-            if (new_brightness - last_written_brightness).abs() > 0.01 {
-                brightness_writer_backlight.lock().unwrap().set_brightness(new_brightness)?;
-                last_written_brightness = new_brightness;
-            }
+            volume_tx.send(AppEvent::VolumeChanged(volume_watcher.wait()?))?;
         }
     });
 
-    let brightness_reader_state = Arc::clone(&app_state);
-    let brightness_reader_backlight = Arc::clone(&backlight);
-    thread::spawn(move || -> Result<()> {
-        loop {
-            thread::sleep(Duration::from_secs(1));
-            if let Ok(current_brightness) = brightness_reader_backlight.lock().unwrap().get_brightness() {
-                let (lock, cvar) = &*brightness_reader_state;
-                let mut state = lock.lock().unwrap();
-                if (current_brightness - state.brightness_value).abs() > 0.01 {
-                    state.brightness_value = current_brightness;
-                    state.needs_redraw = true;
-                    cvar.notify_one();
+    // Everything but rendering happens on this thread. It sleeps until an event arrives
+    // (the clock's minute tick among them) or the earliest deadline passes: the end of an
+    // animation, the control strip's auto-close and a throttled volume write. With nothing
+    // on screen moving it wakes once a minute.
+    let mut last_written_brightness = state.brightness_value;
+    let mut last_written_volume: Option<f64> = None;
+    let mut volume_write_at: Option<Instant> = None;
+    let mut batch = Vec::new();
+    // the first input handled since the last snapshot that changed what's on screen
+    let mut unshown_input: Option<InputTrace> = None;
+    loop {
+        if state.needs_redraw {
+            let mut snapshot = state.snapshot();
+            snapshot.input = unshown_input.take().map(|trace| InputTrace { published: Some(Instant::now()), ..trace });
+            snapshot_writer.publish(snapshot);
+            render_thread.unpark();
+            state.needs_redraw = false;
+        }
+
+        let deadline = [state.animation_deadline(), state.control_strip_deadline(), volume_write_at]
+            .into_iter()
+            .flatten()
+            .min();
+        // take everything that queued up meanwhile, so a fast drag is handled as one
+        // position per pass instead of a backlog the UI trails behind
+        let received = match deadline {
+            Some(deadline) => rx.recv_timeout(deadline.saturating_duration_since(Instant::now())),
+            None => rx.recv().map_err(|_| RecvTimeoutError::Disconnected),
+        };
+        let dequeued = Instant::now();
+        match received {
+            Ok(event) => {
+                input::coalesce(&mut batch, event);
+                while let Ok(event) = rx.try_recv() {
+                    input::coalesce(&mut batch, event);
                 }
             }
+            Err(RecvTimeoutError::Timeout) => {}
+            Err(RecvTimeoutError::Disconnected) => break,
         }
-    });
-
-    let volume_writer_state = Arc::clone(&app_state);
-    let volume_writer_control = Arc::clone(&volume);
-    thread::spawn(move || -> Result<()> {
-        let mut last_written_volume = -1.0;
-        loop {
-            thread::sleep(Duration::from_millis(50));
-            let (lock, _cvar) = &*volume_writer_state;
-            let mut state = lock.lock().unwrap();
 
-            if matches!(state.page, Page::VolumeSlider(_)) {
-                let new_volume = state.volume_value;
-
-                if (new_volume - last_written_volume).abs() > 0.01 && state.last_volume_update.elapsed() > Duration::from_millis(100) {
-                    volume_writer_control.lock().unwrap().set_volume(new_volume)?;
-                    last_written_volume = new_volume;
-                    state.last_volume_update = Instant::now();
+        // the clock/media area only changes with these events or with what a touch shows
+        // in it, so a drag doesn't rebuild it on every pass
+        let dynamic_inputs = state.dynamic_inputs();
+        let mut refresh_dynamic = false;
+        for event in batch.drain(..) {
+            let is_dragging_slider = matches!(state.gesture, app::Gesture::SliderDrag);
+            match event {
+                AppEvent::Input(event, input_time) => {
+                    let kind = event.kind();
+                    state.handle_event(event, dequeued, &mut uinput, &latest_media_info, &media_controller)?;
+                    if state.needs_redraw && unshown_input.is_none() {
+                        unshown_input = Some(InputTrace { kind, input: input_time, dequeued, published: None });
+                    }
+                }
+                AppEvent::MediaChanged => {
+                    record::media(&latest_media_info.lock().unwrap());
+                    refresh_dynamic = true;
+                }
+                AppEvent::ClockTick => refresh_dynamic = true,
+                AppEvent::LayoutsReloaded(reloaded) => {
+                    state.swap_layouts(reloaded, &latest_media_info.lock().unwrap());
+                    refresh_dynamic = true;
+                }
+                AppEvent::LayoutVariantBuilt(variant) => {
+                    state.add_layout_variant(variant);
+                    refresh_dynamic = true;
+                }
+                // our own writes echo back while the slider is dragged; the finger wins
+                AppEvent::BrightnessChanged(value) => {
+                    last_written_brightness = value;
+                    if !is_dragging_slider && (value - state.brightness_value).abs() > 0.01 {
+                        state.brightness_value = value;
+                        state.needs_redraw = true;
+                    }
+                }
+                AppEvent::VolumeChanged(value) => {
+                    last_written_volume = Some(value);
+                    if !is_dragging_slider && (value - state.volume_value).abs() > 0.01 {
+                        state.volume_value = value;
+                        state.needs_redraw = true;
+                    }
                 }
             }
         }
-    });
 
-    let volume_reader_state = Arc::clone(&app_state);
-    let volume_reader_control = Arc::clone(&volume);
-    thread::spawn(move || -> Result<()> {
-        loop {
-            thread::sleep(Duration::from_secs(1));
-            if let Ok(current_volume) = volume_reader_control.lock().unwrap().get_volume() {
-                let (lock, cvar) = &*volume_reader_state;
-                let mut state = lock.lock().unwrap();
-                if (current_volume - state.volume_value).abs() > 0.01 {
-                    state.volume_value = current_volume;
-                    state.needs_redraw = true;
-                    cvar.notify_one();
-                }
+        let now = Instant::now();
+        state.update_animations(now);
+        state.close_idle_control_strip(now);
+        if refresh_dynamic || state.dynamic_inputs() != dynamic_inputs {
+            state.refresh_dynamic(&latest_media_info.lock().unwrap());
+        }
+
+        if (state.brightness_value - last_written_brightness).abs() > 0.01 {
+            // a failed write is retried on the next change, not fatal
+            if let Err(e) = backlight.set_brightness(state.brightness_value) {
+                log_warn!("[backlight] Failed to set brightness: {}", e);
             }
+            last_written_brightness = state.brightness_value;
         }
-    });
 
-    let event_handler_info = Arc::clone(&latest_media_info);
-    for event in rx {
-        let (lock, cvar) = &*app_state;
-        let mut state = lock.lock().unwrap();
-        state.handle_event(event, &mut uinput, &event_handler_info)?;
-        if state.needs_redraw {
-            cvar.notify_one();
+        // setting the volume may mean running wpctl/pactl, so writes are spaced out and
+        // the last value of a quick drag is written once the interval is up
+        volume_write_at = None;
+        if matches!(state.page, Page::VolumeSlider(_))
+            && last_written_volume.map_or(true, |last| (state.volume_value - last).abs() > 0.01)
+        {
+            let next_write = state.last_volume_update + VOLUME_WRITE_INTERVAL;
+            if now >= next_write {
+                // the socket breaks when the sound server restarts; the watcher reconnects
+                // it underneath our sender, so the next write goes to the new server
+                if let Err(e) = volume.set_volume(state.volume_value) {
+                    log_warn!("[volume] Failed to set volume: {}", e);
+                }
+                last_written_volume = Some(state.volume_value);
+                state.last_volume_update = now;
+            } else {
+                volume_write_at = Some(next_write);
+            }
         }
     }
 
@@ -1,6 +1,7 @@
-use serde::Deserialize;
+use serde::{Deserialize, Serialize};
+use std::time::Instant;
 
-#[derive(Clone, Debug, PartialEq, Deserialize)]
+#[derive(Clone, Debug, PartialEq, Serialize, Deserialize)]
 pub enum PlaybackStatus {
     Playing,
     Paused,
@@ -9,6 +10,17 @@ pub enum PlaybackStatus {
     Unknown,
 }
 
+impl From<&str> for PlaybackStatus {
+    fn from(status: &str) -> Self {
+        match status {
+            "Playing" => PlaybackStatus::Playing,
+            "Paused" => PlaybackStatus::Paused,
+            "Stopped" => PlaybackStatus::Stopped,
+            _ => PlaybackStatus::Unknown,
+        }
+    }
+}
+
 impl Default for PlaybackStatus {
     fn default() -> Self {
         PlaybackStatus::Unknown
@@ -16,7 +28,13 @@ impl Default for PlaybackStatus {
 }
 
 
-#[derive(Clone, Debug, PartialEq, Deserialize, Default)]
+fn default_rate() -> f64 {
+    1.0
+}
+
+// `position_usecs` is a sample taken at `sampled_at`; the current position is extrapolated
+// from it with `rate`, so the playhead can move every frame without new data from the player.
+#[derive(Clone, Debug, PartialEq, Serialize, Deserialize)]
 pub struct MediaInfo {
     #[serde(default)]
     pub player_id: String,
@@ -28,23 +46,71 @@ pub struct MediaInfo {
     pub status: PlaybackStatus,
     #[serde(default, rename = "position")]
     position_usecs: i64,
+    // an Instant can't be written out; recordings store the position as of the record's
+    // own timestamp instead (see record::media) and replay restores `sampled_at` from it
+    #[serde(skip, default = "Instant::now")]
+    sampled_at: Instant,
+    #[serde(default = "default_rate")]
+    pub rate: f64,
     #[serde(default, rename = "length")]
     duration_usecs: i64,
     #[serde(default, rename = "icon")]
     pub icon_name: String,
 }
 
+impl Default for MediaInfo {
+    fn default() -> Self {
+        MediaInfo {
+            player_id: String::new(),
+            title: String::new(),
+            artist: String::new(),
+            status: PlaybackStatus::default(),
+            position_usecs: 0,
+            sampled_at: Instant::now(),
+            rate: default_rate(),
+            duration_usecs: 0,
+            icon_name: String::new(),
+        }
+    }
+}
+
 impl MediaInfo {
+    pub fn new(player_id: String, status: PlaybackStatus, title: String, artist: String, duration_usecs: i64) -> Self {
+        let icon_name = player_id.strip_prefix("org.mpris.MediaPlayer2.").unwrap_or_default().to_string();
+        MediaInfo { player_id, title, artist, status, duration_usecs, icon_name, ..Default::default() }
+    }
     pub fn position_s(&self) -> f64 {
         self.position_usecs as f64 / 1_000_000.0
     }
     pub fn position_usecs(&self) -> i64 {
         self.position_usecs
     }
+    pub fn position_s_at(&self, now: Instant) -> f64 {
+        self.position_usecs_at(now) as f64 / 1_000_000.0
+    }
+    pub fn position_usecs_at(&self, now: Instant) -> i64 {
+        let mut position = self.position_usecs;
+        if self.status == PlaybackStatus::Playing {
+            position += (now.saturating_duration_since(self.sampled_at).as_micros() as f64 * self.rate) as i64;
+        }
+        if self.duration_usecs > 0 {
+            position = position.min(self.duration_usecs);
+        }
+        position.max(0)
+    }
     pub fn duration_s(&self) -> f64 {
         self.duration_usecs as f64 / 1_000_000.0
     }
-    pub fn set_position(&mut self, pos_usecs: i64) {
+    pub fn is_advancing(&self) -> bool {
+        self.status == PlaybackStatus::Playing && self.rate > 0.0 && self.duration_usecs > 0
+    }
+    pub fn set_position(&mut self, pos_usecs: i64, now: Instant) {
+        self.position_usecs = pos_usecs;
+        self.sampled_at = now;
+    }
+    pub fn set_position_sample(&mut self, pos_usecs: i64, sampled_at: Instant, rate: f64) {
         self.position_usecs = pos_usecs;
+        self.sampled_at = sampled_at;
+        self.rate = rate;
     }
 }
@@ -0,0 +1,390 @@
+use crate::app::AppEvent;
+use crate::media::{MediaInfo, PlaybackStatus};
+use anyhow::Result;
+use futures_util::StreamExt;
+use std::collections::HashMap;
+use std::env;
+use std::sync::mpsc::Sender;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+use zbus::fdo::DBusProxy;
+use zbus::proxy::CacheProperties;
+use zbus::zvariant::{ObjectPath, OwnedObjectPath, OwnedValue, Value};
+use zbus::{proxy, Connection};
+
+const MPRIS_PREFIX: &str = "org.mpris.MediaPlayer2.";
+const RECONNECT_DELAY: Duration = Duration::from_secs(5);
+
+#[proxy(interface = "org.mpris.MediaPlayer2.Player", default_path = "/org/mpris/MediaPlayer2")]
+trait Player {
+    fn seek(&self, offset: i64) -> zbus::Result<()>;
+
+    fn set_position(&self, track_id: &ObjectPath<'_>, position: i64) -> zbus::Result<()>;
+
+    #[zbus(signal)]
+    fn seeked(&self, position: i64) -> zbus::Result<()>;
+
+    #[zbus(property)]
+    fn playback_status(&self) -> zbus::Result<String>;
+
+    #[zbus(property)]
+    fn metadata(&self) -> zbus::Result<HashMap<String, OwnedValue>>;
+
+    // MPRIS never signals Position, so it must not be served from the property cache.
+    #[zbus(property(emits_changed_signal = "false"))]
+    fn position(&self) -> zbus::Result<i64>;
+
+    #[zbus(property)]
+    fn rate(&self) -> zbus::Result<f64>;
+}
+
+#[derive(Clone, Debug)]
+struct PlayerState {
+    status: PlaybackStatus,
+    title: String,
+    artist: String,
+    track_id: Option<OwnedObjectPath>,
+    length_usecs: i64,
+    position_usecs: i64,
+    position_time: Instant,
+    rate: f64,
+}
+
+impl PlayerState {
+    async fn read(proxy: &PlayerProxy<'_>) -> Self {
+        let mut state = PlayerState {
+            status: PlaybackStatus::Unknown,
+            title: String::new(),
+            artist: String::new(),
+            track_id: None,
+            length_usecs: 0,
+            position_usecs: 0,
+            position_time: Instant::now(),
+            rate: 1.0,
+        };
+        if let Ok(status) = proxy.playback_status().await {
+            state.status = PlaybackStatus::from(status.as_str());
+        }
+        if let Ok(metadata) = proxy.metadata().await {
+            state.apply_metadata(&metadata);
+        }
+        state.rate = proxy.rate().await.unwrap_or(1.0);
+        state.refresh_position(proxy).await;
+        state
+    }
+
+    fn apply_metadata(&mut self, metadata: &HashMap<String, OwnedValue>) {
+        self.title = match metadata.get("xesam:title").map(|v| &**v) {
+            Some(Value::Str(title)) => title.to_string(),
+            _ => String::new(),
+        };
+        self.artist = match metadata.get("xesam:artist").map(|v| &**v) {
+            Some(Value::Array(artists)) => match artists.iter().next() {
+                Some(Value::Str(artist)) => artist.to_string(),
+                _ => String::new(),
+            },
+            _ => String::new(),
+        };
+        self.track_id = match metadata.get("mpris:trackid").map(|v| &**v) {
+            Some(Value::ObjectPath(path)) => Some(path.clone().into()),
+            // some players send the track id as a plain string
+            Some(Value::Str(path)) => OwnedObjectPath::try_from(path.as_str()).ok(),
+            _ => None,
+        };
+        self.length_usecs = match metadata.get("mpris:length").map(|v| &**v) {
+            Some(Value::I64(length)) => *length,
+            Some(Value::U64(length)) => *length as i64,
+            Some(Value::I32(length)) => *length as i64,
+            _ => 0,
+        };
+    }
+
+    async fn refresh_position(&mut self, proxy: &PlayerProxy<'_>) {
+        if let Ok(position) = proxy.position().await {
+            self.set_position(position);
+        }
+    }
+
+    fn set_position(&mut self, position_usecs: i64) {
+        self.position_usecs = position_usecs;
+        self.position_time = Instant::now();
+    }
+
+    fn current_position(&self, now: Instant) -> i64 {
+        let mut position = self.position_usecs;
+        if self.status == PlaybackStatus::Playing {
+            position += (now.saturating_duration_since(self.position_time).as_micros() as f64 * self.rate) as i64;
+        }
+        if self.length_usecs > 0 {
+            position = position.min(self.length_usecs);
+        }
+        position.max(0)
+    }
+}
+
+struct Player {
+    name: String,
+    state: Option<PlayerState>,
+    // uncached proxy used for commands; built on first use.
+    control: Option<PlayerProxy<'static>>,
+    task: JoinHandle<()>,
+}
+
+impl Drop for Player {
+    fn drop(&mut self) {
+        self.task.abort();
+    }
+}
+
+type PlayerUpdate = (String, PlayerState);
+
+#[derive(Debug)]
+enum MediaCommand {
+    SetPosition { player_id: String, position_usecs: i64 },
+}
+
+// Handle for sending commands to players over the client's long-lived bus connection.
+#[derive(Clone)]
+pub struct MediaController {
+    commands: mpsc::UnboundedSender<MediaCommand>,
+}
+
+impl MediaController {
+    // A controller whose commands go nowhere, for replays.
+    pub fn detached() -> Self {
+        let (commands, _) = mpsc::unbounded_channel();
+        MediaController { commands }
+    }
+
+    pub fn set_position(&self, player_id: &str, position_usecs: i64) {
+        let _ = self.commands.send(MediaCommand::SetPosition { player_id: player_id.to_string(), position_usecs });
+    }
+}
+
+fn spawn_player(conn: &Connection, name: String, updates: &mpsc::UnboundedSender<PlayerUpdate>) -> Player {
+    let conn = conn.clone();
+    let updates = updates.clone();
+    let task_name = name.clone();
+    let task = tokio::spawn(async move {
+        if let Err(e) = watch_player(conn, task_name.clone(), updates).await {
+            log_warn!("[mpris] Stopped watching {}: {}", task_name, e);
+        }
+    });
+    Player { name, state: None, control: None, task }
+}
+
+async fn watch_player(conn: Connection, name: String, updates: mpsc::UnboundedSender<PlayerUpdate>) -> zbus::Result<()> {
+    let proxy = PlayerProxy::builder(&conn).destination(name.clone())?.build().await?;
+    let mut status_changes = proxy.receive_playback_status_changed().await;
+    let mut metadata_changes = proxy.receive_metadata_changed().await;
+    let mut rate_changes = proxy.receive_rate_changed().await;
+    let mut seeks = proxy.receive_seeked().await?;
+
+    let mut state = PlayerState::read(&proxy).await;
+    let _ = updates.send((name.clone(), state.clone()));
+
+    loop {
+        tokio::select! {
+            Some(change) = status_changes.next() => {
+                if let Ok(status) = change.get().await {
+                    state.status = PlaybackStatus::from(status.as_str());
+                    state.refresh_position(&proxy).await;
+                }
+            }
+            Some(change) = metadata_changes.next() => {
+                if let Ok(metadata) = change.get().await {
+                    state.apply_metadata(&metadata);
+                    state.refresh_position(&proxy).await;
+                }
+            }
+            Some(change) = rate_changes.next() => {
+                if let Ok(rate) = change.get().await {
+                    state.set_position(state.current_position(Instant::now()));
+                    state.rate = rate;
+                }
+            }
+            Some(seek) = seeks.next() => {
+                if let Ok(args) = seek.args() {
+                    state.set_position(*args.position());
+                }
+            }
+            else => return Ok(()),
+        }
+        let _ = updates.send((name.clone(), state.clone()));
+    }
+}
+
+async fn run_command(conn: &Connection, players: &mut [Player], command: MediaCommand) -> zbus::Result<()> {
+    match command {
+        MediaCommand::SetPosition { player_id, position_usecs } => {
+            let Some(player) = players.iter_mut().find(|p| p.name == player_id) else {
+                return Ok(());
+            };
+            let Some(state) = player.state.as_mut() else {
+                return Ok(());
+            };
+            if player.control.is_none() {
+                player.control = Some(
+                    PlayerProxy::builder(conn)
+                        .destination(player_id.clone())?
+                        .cache_properties(CacheProperties::No)
+                        .build()
+                        .await?,
+                );
+            }
+            let proxy = player.control.clone().unwrap();
+
+            // SetPosition is absolute, so it needs no Position read first. Without a track id
+            // fall back to a relative Seek from the extrapolated position.
+            let track_id = state.track_id.clone();
+            let offset = position_usecs - state.current_position(Instant::now());
+            // show the new position right away, the player's Seeked signal confirms it later
+            state.set_position(position_usecs);
+            tokio::spawn(async move {
+                let result = match track_id {
+                    Some(track_id) => proxy.set_position(&track_id, position_usecs).await,
+                    None => proxy.seek(offset).await,
+                };
+                if let Err(e) = result {
+                    log_warn!("[mpris] Failed to set position: {}", e);
+                }
+            });
+        }
+    }
+    Ok(())
+}
+
+// Same ordering and filtering the helper used: playing players first, then paused ones.
+// Positions are published as samples; readers extrapolate them, so nothing needs to be
+// republished while a track simply keeps playing.
+fn publish(players: &[Player], latest_media_info: &Mutex<Vec<MediaInfo>>, events: &Sender<AppEvent>) {
+    let mut media_info = Vec::new();
+    for wanted in [PlaybackStatus::Playing, PlaybackStatus::Paused] {
+        for player in players {
+            if let Some(state) = player.state.as_ref().filter(|s| s.status == wanted) {
+                let mut info = MediaInfo::new(
+                    player.name.clone(),
+                    state.status.clone(),
+                    state.title.clone(),
+                    state.artist.clone(),
+                    state.length_usecs,
+                );
+                info.set_position_sample(state.position_usecs, state.position_time, state.rate);
+                media_info.push(info);
+            }
+        }
+    }
+
+    let mut info_lock = latest_media_info.lock().unwrap();
+    if *info_lock != media_info {
+        *info_lock = media_info;
+        let _ = events.send(AppEvent::MediaChanged);
+    }
+}
+
+async fn watch_players(
+    conn: &Connection,
+    latest_media_info: &Mutex<Vec<MediaInfo>>,
+    events: &Sender<AppEvent>,
+    commands: &mut mpsc::UnboundedReceiver<MediaCommand>,
+) -> zbus::Result<()> {
+    let dbus = DBusProxy::new(conn).await?;
+    // subscribe before listing so no player can slip through in between
+    let mut owner_changes = dbus.receive_name_owner_changed().await?;
+    let (updates_tx, mut updates_rx) = mpsc::unbounded_channel();
+
+    let mut players: Vec<Player> = Vec::new();
+    for name in dbus.list_names().await? {
+        if name.as_str().starts_with(MPRIS_PREFIX) {
+            players.push(spawn_player(conn, name.to_string(), &updates_tx));
+        }
+    }
+
+    loop {
+        tokio::select! {
+            Some(signal) = owner_changes.next() => {
+                let args = signal.args()?;
+                let name = args.name().as_str();
+                if !name.starts_with(MPRIS_PREFIX) {
+                    continue;
+                }
+                players.retain(|p| p.name != name);
+                if args.new_owner().is_some() {
+                    log_info!("[mpris] Player appeared: {}", name);
+                    players.push(spawn_player(conn, name.to_string(), &updates_tx));
+                } else {
+                    log_info!("[mpris] Player vanished: {}", name);
+                }
+            }
+            Some((name, state)) = updates_rx.recv() => {
+                if let Some(player) = players.iter_mut().find(|p| p.name == name) {
+                    player.state = Some(state);
+                }
+            }
+            Some(command) = commands.recv() => {
+                if let Err(e) = run_command(conn, &mut players, command).await {
+                    log_warn!("[mpris] Failed to send command: {}", e);
+                }
+            }
+            else => return Ok(()),
+        }
+        publish(&players, latest_media_info, events);
+    }
+}
+
+// Switches the effective uid of the calling thread only. libc's seteuid would switch every
+// thread of the daemon, including the ones that open input and DRM devices.
+fn set_thread_euid(uid: u32) -> std::io::Result<()> {
+    let unchanged = libc::uid_t::MAX;
+    if unsafe { libc::syscall(libc::SYS_setresuid, unchanged, uid as libc::uid_t, unchanged) } < 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+// dfr_daemon runs as root, so the session bus of the user who started it has to be named
+// explicitly. A session bus only accepts its owner: the socket is opened with the user's
+// uid, which is what the bus sees as the peer's credentials, and EXTERNAL auth claims the
+// same uid.
+async fn connect() -> zbus::Result<Connection> {
+    let Some(uid) = env::var("SUDO_UID").ok().and_then(|uid| uid.parse::<u32>().ok()) else {
+        return Connection::session().await;
+    };
+    set_thread_euid(uid)?;
+    let stream = std::os::unix::net::UnixStream::connect(format!("/run/user/{}/bus", uid));
+    set_thread_euid(0)?;
+    let stream = stream?;
+    stream.set_nonblocking(true)?;
+    zbus::connection::Builder::unix_stream(tokio::net::UnixStream::from_std(stream)?)
+        .user_id(uid)
+        .build()
+        .await
+}
+
+// `events` is told whenever `latest_media_info` changes.
+pub fn start_mpris_client(latest_media_info: Arc<Mutex<Vec<MediaInfo>>>, events: Sender<AppEvent>) -> Result<MediaController> {
+    let runtime = tokio::runtime::Builder::new_current_thread().enable_all().build()?;
+    let (commands_tx, mut commands_rx) = mpsc::unbounded_channel();
+    thread::spawn(move || {
+        runtime.block_on(async {
+            loop {
+                match connect().await {
+                    Ok(conn) => {
+                        log_info!("[mpris] Connected to session bus.");
+                        if let Err(e) = watch_players(&conn, &latest_media_info, &events, &mut commands_rx).await {
+                            log_warn!("[mpris] Lost session bus: {}", e);
+                        }
+                    }
+                    Err(e) => log_warn!("[mpris] Could not connect to session bus: {}", e),
+                }
+                latest_media_info.lock().unwrap().clear();
+                let _ = events.send(AppEvent::MediaChanged);
+                tokio::time::sleep(RECONNECT_DELAY).await;
+            }
+        })
+    });
+    Ok(MediaController { commands: commands_tx })
+}
@@ -0,0 +1,40 @@
+// A presenter that keeps frames in memory, for rendering without a Touch Bar:
+// benchmarks, and anything else that wants the pixels instead of the panel.
+
+use crate::dynamic::Rect;
+use crate::renderer::Presenter;
+use anyhow::Result;
+use cairo::{Format, ImageSurface};
+
+pub struct OffscreenBackend {
+    width: i32,
+    height: i32,
+}
+
+impl OffscreenBackend {
+    // `width` and `height` are physical, like the panel's mode: a tall, narrow strip.
+    pub fn new(width: i32, height: i32) -> Self {
+        OffscreenBackend { width, height }
+    }
+}
+
+impl Presenter for OffscreenBackend {
+    fn get_dimensions(&self) -> (i32, i32) {
+        (self.width, self.height)
+    }
+
+    // A single buffer that always holds the previous frame, so the damaged columns are
+    // all a frame has to repaint.
+    fn surfaces(&mut self) -> Result<Vec<ImageSurface>> {
+        Ok(vec![ImageSurface::create(Format::Rgb24, self.width, self.height)?])
+    }
+
+    fn begin_frame(&mut self, damage: Option<&[Rect]>) -> Result<(usize, Option<Vec<Rect>>)> {
+        Ok((0, damage.map(|rects| rects.to_vec())))
+    }
+
+    fn present(&mut self, surface: &mut ImageSurface, _repaint: Option<&[Rect]>, _damage: Option<&[Rect]>) -> Result<()> {
+        surface.flush();
+        Ok(())
+    }
+}
@@ -0,0 +1,385 @@
+// A minimal client for the PulseAudio native protocol, which both PulseAudio and
+// pipewire-pulse serve. It only knows enough to read and set the default sink's
+// volume and to subscribe to sink changes.
+
+use anyhow::{anyhow, Result};
+use std::env;
+use std::fs;
+use std::io::{Read, Write};
+use std::os::unix::net::UnixStream;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+use nix::unistd::User;
+
+const PROTOCOL_VERSION: u32 = 32;
+const COOKIE_LENGTH: usize = 256;
+const CONTROL_CHANNEL: u32 = u32::MAX;
+const INVALID_INDEX: u32 = u32::MAX;
+const DEFAULT_SINK: &str = "@DEFAULT_SINK@";
+pub const VOLUME_NORM: u32 = 0x10000;
+const HANDSHAKE_TIMEOUT: Duration = Duration::from_secs(2);
+
+const COMMAND_ERROR: u32 = 0;
+const COMMAND_REPLY: u32 = 2;
+const COMMAND_AUTH: u32 = 8;
+const COMMAND_SET_CLIENT_NAME: u32 = 9;
+const COMMAND_GET_SINK_INFO: u32 = 21;
+const COMMAND_SUBSCRIBE: u32 = 35;
+const COMMAND_SET_SINK_VOLUME: u32 = 36;
+const COMMAND_SUBSCRIBE_EVENT: u32 = 66;
+
+const SUBSCRIPTION_MASK_SINK: u32 = 0x0001;
+const SUBSCRIPTION_MASK_SERVER: u32 = 0x0080;
+
+const TAG_STRING: u8 = b't';
+const TAG_STRING_NULL: u8 = b'N';
+const TAG_U32: u8 = b'L';
+const TAG_SAMPLE_SPEC: u8 = b'a';
+const TAG_ARBITRARY: u8 = b'x';
+const TAG_CHANNEL_MAP: u8 = b'm';
+const TAG_CVOLUME: u8 = b'v';
+const TAG_PROPLIST: u8 = b'P';
+
+// Commands are serialized as a "tagstruct": every value is prefixed by a type tag,
+// integers are big endian and strings are NUL terminated.
+struct TagWriter(Vec<u8>);
+
+impl TagWriter {
+    fn command(command: u32, tag: u32) -> Self {
+        let mut writer = TagWriter(Vec::new());
+        writer.u32(command);
+        writer.u32(tag);
+        writer
+    }
+
+    fn u32(&mut self, value: u32) {
+        self.0.push(TAG_U32);
+        self.0.extend_from_slice(&value.to_be_bytes());
+    }
+
+    fn string(&mut self, value: Option<&str>) {
+        match value {
+            Some(value) => {
+                self.0.push(TAG_STRING);
+                self.0.extend_from_slice(value.as_bytes());
+                self.0.push(0);
+            }
+            None => self.0.push(TAG_STRING_NULL),
+        }
+    }
+
+    fn arbitrary(&mut self, data: &[u8]) {
+        self.0.push(TAG_ARBITRARY);
+        self.0.extend_from_slice(&(data.len() as u32).to_be_bytes());
+        self.0.extend_from_slice(data);
+    }
+
+    fn proplist(&mut self, props: &[(&str, &str)]) {
+        self.0.push(TAG_PROPLIST);
+        for (key, value) in props {
+            let mut value = value.as_bytes().to_vec();
+            value.push(0);
+            self.string(Some(key));
+            self.u32(value.len() as u32);
+            self.arbitrary(&value);
+        }
+        self.string(None);
+    }
+
+    fn cvolume(&mut self, volumes: &[u32]) {
+        self.0.push(TAG_CVOLUME);
+        self.0.push(volumes.len() as u8);
+        for volume in volumes {
+            self.0.extend_from_slice(&volume.to_be_bytes());
+        }
+    }
+
+    // Wraps the tagstruct in a packet descriptor: length, channel, offset (two words), flags.
+    fn into_packet(self) -> Vec<u8> {
+        let mut packet = Vec::with_capacity(20 + self.0.len());
+        packet.extend_from_slice(&(self.0.len() as u32).to_be_bytes());
+        packet.extend_from_slice(&CONTROL_CHANNEL.to_be_bytes());
+        packet.extend_from_slice(&[0; 12]);
+        packet.extend_from_slice(&self.0);
+        packet
+    }
+}
+
+struct TagReader<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> TagReader<'a> {
+    fn take(&mut self, len: usize) -> Result<&'a [u8]> {
+        if self.data.len() < len {
+            return Err(anyhow!("Truncated PulseAudio packet"));
+        }
+        let (head, tail) = self.data.split_at(len);
+        self.data = tail;
+        Ok(head)
+    }
+
+    fn expect(&mut self, tag: u8) -> Result<()> {
+        let found = self.take(1)?[0];
+        if found != tag {
+            return Err(anyhow!("Expected PulseAudio tag '{}', found '{}'", tag as char, found as char));
+        }
+        Ok(())
+    }
+
+    fn u32(&mut self) -> Result<u32> {
+        self.expect(TAG_U32)?;
+        Ok(u32::from_be_bytes(self.take(4)?.try_into()?))
+    }
+
+    fn string(&mut self) -> Result<Option<&'a str>> {
+        match self.take(1)?[0] {
+            TAG_STRING_NULL => Ok(None),
+            TAG_STRING => {
+                let len = self.data.iter().position(|&b| b == 0).ok_or(anyhow!("Unterminated PulseAudio string"))?;
+                let value = std::str::from_utf8(self.take(len)?)?;
+                self.take(1)?;
+                Ok(Some(value))
+            }
+            tag => Err(anyhow!("Expected PulseAudio string, found '{}'", tag as char)),
+        }
+    }
+
+    fn skip_sample_spec(&mut self) -> Result<()> {
+        self.expect(TAG_SAMPLE_SPEC)?;
+        self.take(6)?;
+        Ok(())
+    }
+
+    fn skip_channel_map(&mut self) -> Result<()> {
+        self.expect(TAG_CHANNEL_MAP)?;
+        let channels = self.take(1)?[0] as usize;
+        self.take(channels)?;
+        Ok(())
+    }
+
+    fn cvolume(&mut self) -> Result<Vec<u32>> {
+        self.expect(TAG_CVOLUME)?;
+        let channels = self.take(1)?[0] as usize;
+        (0..channels).map(|_| Ok(u32::from_be_bytes(self.take(4)?.try_into()?))).collect()
+    }
+}
+
+fn socket_path() -> Result<PathBuf> {
+    if let Ok(server) = env::var("PULSE_SERVER") {
+        if let Some(path) = server.strip_prefix("unix:") {
+            return Ok(PathBuf::from(path));
+        }
+    }
+    let runtime_dir = match env::var("SUDO_UID") {
+        Ok(uid) => PathBuf::from(format!("/run/user/{}", uid)),
+        Err(_) => PathBuf::from(env::var("XDG_RUNTIME_DIR").map_err(|_| anyhow!("XDG_RUNTIME_DIR is not set"))?),
+    };
+    Ok(runtime_dir.join("pulse/native"))
+}
+
+// The home of the user whose server we talk to: whoever ran sudo, or ourselves.
+fn home_dir() -> Option<PathBuf> {
+    match env::var("SUDO_USER") {
+        Ok(user) => User::from_name(&user).ok().flatten().map(|user| user.dir),
+        Err(_) => env::var_os("HOME").map(PathBuf::from),
+    }
+}
+
+// Where libpulse looks for the cookie, in the same order.
+fn cookie_paths() -> Vec<PathBuf> {
+    if let Some(path) = env::var_os("PULSE_COOKIE") {
+        return vec![PathBuf::from(path)];
+    }
+    let home = home_dir();
+    let config_dir = env::var_os("XDG_CONFIG_HOME")
+        .map(PathBuf::from)
+        .or_else(|| home.as_ref().map(|home| home.join(".config")));
+    config_dir.map(|dir| dir.join("pulse/cookie")).into_iter()
+        .chain(home.map(|home| home.join(".pulse-cookie")))
+        .collect()
+}
+
+// PulseAudio authenticates clients of another user by cookie; pipewire-pulse
+// accepts any cookie, so a missing one is sent as zeros.
+fn cookie() -> Vec<u8> {
+    cookie_paths().into_iter()
+        .filter_map(|path| fs::read(path).ok())
+        .find(|cookie| cookie.len() == COOKIE_LENGTH)
+        .unwrap_or_else(|| vec![0; COOKIE_LENGTH])
+}
+
+enum Packet {
+    Reply { tag: u32, data: Vec<u8> },
+    Error { tag: u32, code: u32 },
+    SubscribeEvent,
+}
+
+// The reading half of the connection. Only one thread should own it.
+pub struct Connection {
+    stream: UnixStream,
+    sender: Sender,
+}
+
+// The writing half, shared by whoever needs to send requests.
+#[derive(Clone)]
+pub struct Sender {
+    stream: Arc<Mutex<UnixStream>>,
+    next_tag: Arc<AtomicU32>,
+}
+
+impl Sender {
+    fn send(&self, build: impl FnOnce(u32) -> TagWriter) -> Result<u32> {
+        let tag = self.next_tag.fetch_add(1, Ordering::Relaxed);
+        let packet = build(tag).into_packet();
+        self.stream.lock().unwrap().write_all(&packet)?;
+        Ok(tag)
+    }
+
+    // Fire and forget; the reply is drained by whoever reads the connection.
+    pub fn set_default_sink_volume(&self, volume: u32) -> Result<()> {
+        self.send(|tag| {
+            let mut command = TagWriter::command(COMMAND_SET_SINK_VOLUME, tag);
+            command.u32(INVALID_INDEX);
+            command.string(Some(DEFAULT_SINK));
+            // a single channel volume is applied to every channel of the sink
+            command.cvolume(&[volume]);
+            command
+        })?;
+        Ok(())
+    }
+}
+
+impl Connection {
+    pub fn open() -> Result<Self> {
+        let stream = UnixStream::connect(socket_path()?)?;
+        let sender = Sender {
+            stream: Arc::new(Mutex::new(stream.try_clone()?)),
+            next_tag: Arc::new(AtomicU32::new(0)),
+        };
+        let mut connection = Connection { stream, sender };
+        connection.handshake()?;
+        Ok(connection)
+    }
+
+    // Reconnects in place; Senders handed out earlier keep working on the new socket.
+    pub fn reopen(&mut self) -> Result<()> {
+        self.stream = UnixStream::connect(socket_path()?)?;
+        *self.sender.stream.lock().unwrap() = self.stream.try_clone()?;
+        self.handshake()
+    }
+
+    pub fn sender(&self) -> Sender {
+        self.sender.clone()
+    }
+
+    // A server that accepts the connection and then hangs must not hang us with it, so
+    // the handshake is bounded; afterwards reads block for as long as events take.
+    fn handshake(&mut self) -> Result<()> {
+        self.stream.set_read_timeout(Some(HANDSHAKE_TIMEOUT))?;
+        self.stream.set_write_timeout(Some(HANDSHAKE_TIMEOUT))?;
+        let result = self.exchange_handshake();
+        self.stream.set_read_timeout(None)?;
+        self.stream.set_write_timeout(None)?;
+        result
+    }
+
+    fn exchange_handshake(&mut self) -> Result<()> {
+        let tag = self.sender.send(|tag| {
+            let mut command = TagWriter::command(COMMAND_AUTH, tag);
+            command.u32(PROTOCOL_VERSION);
+            command.arbitrary(&cookie());
+            command
+        })?;
+        self.wait_reply(tag)?;
+
+        let tag = self.sender.send(|tag| {
+            let mut command = TagWriter::command(COMMAND_SET_CLIENT_NAME, tag);
+            command.proplist(&[("application.name", "ndfr"), ("application.id", "ndfr")]);
+            command
+        })?;
+        self.wait_reply(tag)?;
+
+        let tag = self.sender.send(|tag| {
+            let mut command = TagWriter::command(COMMAND_SUBSCRIBE, tag);
+            command.u32(SUBSCRIPTION_MASK_SINK | SUBSCRIPTION_MASK_SERVER);
+            command
+        })?;
+        self.wait_reply(tag)?;
+        Ok(())
+    }
+
+    fn read_packet(&mut self) -> Result<Packet> {
+        loop {
+            let mut descriptor = [0u8; 20];
+            self.stream.read_exact(&mut descriptor)?;
+            let len = u32::from_be_bytes(descriptor[0..4].try_into()?) as usize;
+            let channel = u32::from_be_bytes(descriptor[4..8].try_into()?);
+            let mut data = vec![0u8; len];
+            self.stream.read_exact(&mut data)?;
+            // memblocks belong to streams, and we never create any
+            if channel != CONTROL_CHANNEL {
+                continue;
+            }
+
+            let mut reader = TagReader { data: &data };
+            let command = reader.u32()?;
+            let tag = reader.u32()?;
+            match command {
+                COMMAND_REPLY => {
+                    let data = reader.data.to_vec();
+                    return Ok(Packet::Reply { tag, data });
+                }
+                COMMAND_ERROR => return Ok(Packet::Error { tag, code: reader.u32()? }),
+                COMMAND_SUBSCRIBE_EVENT => return Ok(Packet::SubscribeEvent),
+                _ => {}
+            }
+        }
+    }
+
+    // Blocks until the server reports a change to a sink or to the server itself
+    // (which covers the default sink being switched).
+    pub fn wait_event(&mut self) -> Result<()> {
+        loop {
+            if let Packet::SubscribeEvent = self.read_packet()? {
+                return Ok(());
+            }
+        }
+    }
+
+    // Reads until the reply to `tag` arrives, dropping anything else on the way.
+    fn wait_reply(&mut self, tag: u32) -> Result<Vec<u8>> {
+        loop {
+            match self.read_packet()? {
+                Packet::Reply { tag: reply_tag, data } if reply_tag == tag => return Ok(data),
+                Packet::Error { tag: error_tag, code } if error_tag == tag => {
+                    return Err(anyhow!("PulseAudio request failed with error {}", code));
+                }
+                _ => {}
+            }
+        }
+    }
+
+    // Returns the loudest channel of the default sink, where VOLUME_NORM is 100%.
+    pub fn default_sink_volume(&mut self) -> Result<u32> {
+        let tag = self.sender.send(|tag| {
+            let mut command = TagWriter::command(COMMAND_GET_SINK_INFO, tag);
+            command.u32(INVALID_INDEX);
+            command.string(Some(DEFAULT_SINK));
+            command
+        })?;
+        let data = self.wait_reply(tag)?;
+
+        // index, name, description, sample spec, channel map, owner module, volume, ...
+        let mut reader = TagReader { data: &data };
+        reader.u32()?;
+        reader.string()?;
+        reader.string()?;
+        reader.skip_sample_spec()?;
+        reader.skip_channel_map()?;
+        reader.u32()?;
+        Ok(reader.cvolume()?.into_iter().max().unwrap_or(0))
+    }
+}
@@ -0,0 +1,177 @@
+// Capture of everything the daemon reacts to from outside: raw evdev events from the
+// Touch Bar and the keyboard, and the media state. `dfr_daemon record <file>` runs the
+// daemon as usual while writing them out; `dfr_daemon replay <file>` plays them back.
+//
+// The file is a header followed by records, all little-endian:
+//   header: MAGIC, has_physical_esc u8
+//   record: source u8, microseconds since the start u64, then for
+//     SOURCE_TOUCH / SOURCE_KEYBOARD: type u16, code u16, value i32
+//     SOURCE_MEDIA: length u32, then the player list as JSON, with each position
+//       extrapolated to the record's time so replay can resume the extrapolation from there
+
+use crate::media::MediaInfo;
+use anyhow::{anyhow, Result};
+use std::fs::File;
+use std::io::{BufReader, BufWriter, ErrorKind, Read, Write};
+use std::path::Path;
+use std::sync::{Mutex, OnceLock};
+use std::time::{Duration, Instant};
+
+const MAGIC: &[u8; 8] = b"DFRREC1\n";
+const SOURCE_TOUCH: u8 = 0;
+const SOURCE_KEYBOARD: u8 = 1;
+const SOURCE_MEDIA: u8 = 2;
+
+pub enum Record {
+    Touch { kind: u16, code: u16, value: i32 },
+    Keyboard { kind: u16, code: u16, value: i32 },
+    Media(Vec<MediaInfo>),
+}
+
+struct Recorder {
+    out: Mutex<BufWriter<File>>,
+    start: Instant,
+}
+
+static RECORDER: OnceLock<Recorder> = OnceLock::new();
+
+pub fn start(path: &Path, has_physical_esc: bool) -> Result<()> {
+    let mut out = BufWriter::new(File::create(path)?);
+    out.write_all(MAGIC)?;
+    out.write_all(&[has_physical_esc as u8])?;
+    out.flush()?;
+    RECORDER
+        .set(Recorder { out: Mutex::new(out), start: Instant::now() })
+        .map_err(|_| anyhow!("Already recording"))?;
+    log_info!("[record] Recording input to {}", path.display());
+    Ok(())
+}
+
+fn write(time: Instant, source: u8, payload: &[u8]) {
+    let Some(recorder) = RECORDER.get() else { return };
+    let micros = time.saturating_duration_since(recorder.start).as_micros() as u64;
+    let mut out = recorder.out.lock().unwrap();
+    let result = out.write_all(&[source])
+        .and_then(|_| out.write_all(&micros.to_le_bytes()))
+        .and_then(|_| out.write_all(payload));
+    if let Err(e) = result {
+        log_warn!("[record] Write failed: {}", e);
+    }
+}
+
+fn raw_payload(kind: u16, code: u16, value: i32) -> [u8; 8] {
+    let mut payload = [0; 8];
+    payload[0..2].copy_from_slice(&kind.to_le_bytes());
+    payload[2..4].copy_from_slice(&code.to_le_bytes());
+    payload[4..8].copy_from_slice(&value.to_le_bytes());
+    payload
+}
+
+// Everything below is a no-op unless a recording was started.
+
+pub fn is_recording() -> bool {
+    RECORDER.get().is_some()
+}
+
+pub fn touch(time: Instant, kind: u16, code: u16, value: i32) {
+    write(time, SOURCE_TOUCH, &raw_payload(kind, code, value));
+}
+
+pub fn keyboard(time: Instant, kind: u16, code: u16, value: i32) {
+    write(time, SOURCE_KEYBOARD, &raw_payload(kind, code, value));
+}
+
+pub fn media(media_info: &[MediaInfo]) {
+    if RECORDER.get().is_none() {
+        return;
+    }
+    let now = Instant::now();
+    let media_info: Vec<MediaInfo> = media_info.iter().map(|info| {
+        let mut info = info.clone();
+        info.set_position_sample(info.position_usecs_at(now), now, info.rate);
+        info
+    }).collect();
+    match serde_json::to_vec(&media_info) {
+        Ok(json) => {
+            let mut payload = (json.len() as u32).to_le_bytes().to_vec();
+            payload.extend_from_slice(&json);
+            write(now, SOURCE_MEDIA, &payload);
+            flush();
+        }
+        Err(e) => log_warn!("[record] Cannot encode media state: {}", e),
+    }
+}
+
+// Called after each batch, so a capture cut short by a kill loses at most one batch.
+pub fn flush() {
+    if let Some(recorder) = RECORDER.get() {
+        let _ = recorder.out.lock().unwrap().flush();
+    }
+}
+
+pub struct Recording {
+    input: BufReader<File>,
+    pub has_physical_esc: bool,
+}
+
+impl Recording {
+    pub fn open(path: &Path) -> Result<Self> {
+        let mut input = BufReader::new(File::open(path)?);
+        let mut magic = [0; 8];
+        input.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            return Err(anyhow!("{} is not a recording", path.display()));
+        }
+        let mut esc = [0; 1];
+        input.read_exact(&mut esc)?;
+        Ok(Recording { input, has_physical_esc: esc[0] != 0 })
+    }
+
+    // Fills `buf`, or returns false if the file ends first. A capture that was killed may
+    // end mid-record, since the writer flushes whatever part of a record it buffered.
+    fn read_or_end(&mut self, buf: &mut [u8]) -> Result<bool> {
+        match self.input.read_exact(buf) {
+            Ok(()) => Ok(true),
+            Err(e) if e.kind() == ErrorKind::UnexpectedEof => Ok(false),
+            Err(e) => Err(e.into()),
+        }
+    }
+
+    // The next record and when it happened, or None at the end of the file.
+    pub fn next(&mut self) -> Result<Option<(Duration, Record)>> {
+        let mut header = [0; 9];
+        if !self.read_or_end(&mut header)? {
+            return Ok(None);
+        }
+        let time = Duration::from_micros(u64::from_le_bytes(header[1..9].try_into()?));
+        let record = match header[0] {
+            SOURCE_TOUCH | SOURCE_KEYBOARD => {
+                let mut payload = [0; 8];
+                if !self.read_or_end(&mut payload)? {
+                    return Ok(None);
+                }
+                let kind = u16::from_le_bytes([payload[0], payload[1]]);
+                let code = u16::from_le_bytes([payload[2], payload[3]]);
+                let value = i32::from_le_bytes(payload[4..8].try_into()?);
+                if header[0] == SOURCE_TOUCH {
+                    Record::Touch { kind, code, value }
+                } else {
+                    Record::Keyboard { kind, code, value }
+                }
+            }
+            SOURCE_MEDIA => {
+                let mut len = [0; 4];
+                if !self.read_or_end(&mut len)? {
+                    return Ok(None);
+                }
+                let mut json = vec![0; u32::from_le_bytes(len) as usize];
+                if !self.read_or_end(&mut json)? {
+                    return Ok(None);
+                }
+                Record::Media(serde_json::from_slice(&json)?)
+            }
+            source => return Err(anyhow!("Unknown record source {}", source)),
+        };
+        Ok(Some((time, record)))
+    }
+}
@@ -0,0 +1,112 @@
+// Watches layout.yml and icons/ and rebuilds the layouts an edit affects on this thread,
+// so the main loop only swaps finished layouts in and the strip never goes blank.
+
+use crate::app::AppEvent;
+use crate::icons;
+use crate::media::MediaInfo;
+use crate::ui::{create_expanded_layout, find_resource_path, Button, LayoutCompiler};
+use anyhow::{anyhow, Result};
+use nix::poll::{poll, PollFd, PollFlags};
+use nix::sys::inotify::{AddWatchFlags, InitFlags, Inotify};
+use std::collections::HashSet;
+use std::os::fd::{AsRawFd, BorrowedFd};
+use std::sync::mpsc::Sender;
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+// editors save in bursts (write, rename, chmod); wait for them to settle
+const SETTLE_MS: i32 = 50;
+
+// Layouts rebuilt after an edit. Fields left None weren't affected.
+#[derive(Debug)]
+pub struct ReloadedLayouts {
+    pub default: Option<LayoutCompiler>,
+    pub expanded: Option<Arc<Vec<Button>>>,
+}
+
+#[derive(Default)]
+struct Changes {
+    layout: bool,
+    icons: HashSet<String>,
+}
+
+fn wait_readable(inotify: &Inotify, timeout: i32) -> Result<bool> {
+    let fd = unsafe { BorrowedFd::borrow_raw(inotify.as_raw_fd()) };
+    let mut fds = [PollFd::new(&fd, PollFlags::POLLIN)];
+    Ok(poll(&mut fds, timeout)? > 0)
+}
+
+pub fn start_resource_watcher(
+    tx: Sender<AppEvent>,
+    width: i32,
+    height: i32,
+    has_physical_esc: bool,
+    latest_media_info: Arc<Mutex<Vec<MediaInfo>>>,
+) -> Result<()> {
+    let layout_path = find_resource_path("layout.yml")?;
+    let icons_dir = find_resource_path("icons")?;
+    // the directories, not the files: editors replace a file by renaming over it
+    let layout_dir = layout_path.parent().ok_or_else(|| anyhow!("layout.yml has no parent directory"))?.to_path_buf();
+    let mask = AddWatchFlags::IN_CLOSE_WRITE | AddWatchFlags::IN_MOVED_TO | AddWatchFlags::IN_MOVED_FROM | AddWatchFlags::IN_DELETE;
+
+    let inotify = Inotify::init(InitFlags::IN_NONBLOCK | InitFlags::IN_CLOEXEC)?;
+    let layout_watch = inotify.add_watch(&layout_dir, mask)?;
+    let icons_watch = inotify.add_watch(&icons_dir, mask)?;
+    log_info!("[reload] Watching {} and {}", layout_path.display(), icons_dir.display());
+
+    thread::spawn(move || -> Result<()> {
+        loop {
+            wait_readable(&inotify, -1)?;
+            let mut changes = Changes::default();
+            loop {
+                for event in inotify.read_events().unwrap_or_default() {
+                    let Some(name) = event.name.as_ref().and_then(|n| n.to_str()) else {
+                        continue;
+                    };
+                    if event.wd == layout_watch && name == "layout.yml" {
+                        changes.layout = true;
+                    } else if event.wd == icons_watch && name.ends_with(".svg") {
+                        changes.icons.insert(name.to_string());
+                    }
+                }
+                if !wait_readable(&inotify, SETTLE_MS)? {
+                    break;
+                }
+            }
+            if !changes.layout && changes.icons.is_empty() {
+                continue;
+            }
+
+            for name in &changes.icons {
+                if let Err(e) = icons::atlas().reload(name) {
+                    log_warn!("[reload] Keeping the old {}: {}", name, e);
+                }
+            }
+
+            // any icon may be on the default layout; the Fn row is text only
+            let reloaded = ReloadedLayouts {
+                default: match LayoutCompiler::new(width, height, has_physical_esc) {
+                    Ok(mut compiler) => {
+                        // warm the variant that's on screen, so the swap costs nothing
+                        let media_info = latest_media_info.lock().unwrap().clone();
+                        compiler.default_layout(&media_info).map(|_| compiler).ok()
+                    }
+                    Err(e) => {
+                        log_warn!("[reload] Keeping the old layout: {}", e);
+                        None
+                    }
+                },
+                expanded: if changes.icons.is_empty() {
+                    None
+                } else {
+                    create_expanded_layout(width, height).map(Arc::new).ok()
+                },
+            };
+            if reloaded.default.is_some() || reloaded.expanded.is_some() {
+                log_info!("[reload] Rebuilt layouts (layout.yml changed: {}, icons changed: {})", changes.layout, changes.icons.len());
+                tx.send(AppEvent::LayoutsReloaded(reloaded))?;
+            }
+        }
+    });
+    Ok(())
+}
@@ -1,18 +1,23 @@
 use crate::app::Gesture;
 use crate::dynamic::{DynamicDrawable, Rect};
-use crate::ui::Page;
+use crate::latency;
+use crate::ui::{Button, Page, Slider, BUTTON_RADIUS};
 use anyhow::{anyhow, Result};
-use cairo::ImageSurface;
+use cairo::{Format, ImageSurface};
 use drm::control::{
     atomic, connector,
     dumbbuffer::DumbBuffer,
-    framebuffer, property, AtomicCommitFlags, Device as ControlDevice, Mode,
+    framebuffer, plane, property, AtomicCommitFlags, Device as ControlDevice, Event, Mode,
 };
 use drm::Device as DrmDevice;
+use nix::poll::{poll, PollFd, PollFlags};
 use std::{
     fs::{self, File, OpenOptions},
+    mem,
     os::unix::io::AsFd,
     path::Path,
+    sync::Arc,
+    time::{Duration, Instant},
 };
 
 struct Card(File);
@@ -49,11 +54,113 @@ fn find_prop_id<T: drm::control::ResourceHandle>(
     Err(anyhow!("Could not find property '{}'", name))
 }
 
+// The dumb buffer stays mapped for the life of the backend instead of being
+// mapped and unmapped around every frame.
+struct Mapping {
+    ptr: *mut u8,
+    len: usize,
+}
+
+// The mapping is only ever touched by whichever thread owns the backend.
+unsafe impl Send for Mapping {}
+
+impl Mapping {
+    fn new(card: &Card, db: &mut DumbBuffer) -> Result<Self> {
+        let mut map = card.map_dumb_buffer(db)?;
+        let mapping = Mapping { ptr: map.as_mut().as_mut_ptr(), len: map.len() };
+        // DumbMapping unmaps on drop; ownership of the pages moves to Mapping.
+        mem::forget(map);
+        Ok(mapping)
+    }
+
+    fn as_mut(&mut self) -> &mut [u8] {
+        unsafe { std::slice::from_raw_parts_mut(self.ptr, self.len) }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        let _ = unsafe { nix::sys::mman::munmap(self.ptr as *mut _, self.len) };
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+enum PresentMode {
+    // cairo draws straight into the mapped scanout buffer
+    Direct,
+    // cairo draws into its own surface and repainted rows are copied across
+    Shadow,
+}
+
+// One framebuffer of the swap chain.
+struct Buffer {
+    db: DumbBuffer,
+    fb: framebuffer::Handle,
+    mapping: Mapping,
+    // logical columns that changed on screen since this buffer was last drawn;
+    // None means its contents can't be trusted at all
+    stale: Option<Vec<Rect>>,
+}
+
+// struct drm_mode_rect, the element type of the FB_DAMAGE_CLIPS blob
+#[repr(C)]
+struct DamageClip {
+    x1: i32,
+    y1: i32,
+    x2: i32,
+    y2: i32,
+}
+
+const SWAP_CHAIN_LENGTH: usize = 3;
+const FLIP_TIMEOUT_MS: i32 = 100;
+
+// Where finished frames go. The render loop draws into the surfaces a presenter hands
+// out and tells it which one is done; the Touch Bar is one presenter, memory another.
+pub trait Presenter {
+    // Physical size of the surfaces, portrait like the panel itself.
+    fn get_dimensions(&self) -> (i32, i32);
+    // One surface per buffer, indexed like begin_frame's result.
+    fn surfaces(&mut self) -> Result<Vec<ImageSurface>>;
+    // Picks the buffer to draw the next frame into and the logical columns to repaint
+    // in it (None for everything), given what changed since the last frame.
+    fn begin_frame(&mut self, damage: Option<&[Rect]>) -> Result<(usize, Option<Vec<Rect>>)>;
+    // Shows the buffer picked by begin_frame.
+    fn present(&mut self, surface: &mut ImageSurface, repaint: Option<&[Rect]>, damage: Option<&[Rect]>) -> Result<()>;
+    // Where the last present spent its time; presenters without those steps report zeros.
+    fn present_timings(&self) -> PresentTimings {
+        PresentTimings::default()
+    }
+    // Blocks until every presented frame is on screen.
+    fn wait_idle(&mut self) -> Result<()> {
+        Ok(())
+    }
+    // When the latest completed flip put a frame on screen, if the presenter knows.
+    fn last_flip(&self) -> Option<Instant> {
+        None
+    }
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+pub struct PresentTimings {
+    pub copy: Duration,
+    pub flip_wait: Duration,
+    pub commit: Duration,
+}
+
 pub struct DrmBackend {
     card: Card,
     pub mode: Mode,
-    db: DumbBuffer,
-    fb: framebuffer::Handle,
+    plane: plane::Handle,
+    fb_id_prop: property::Handle,
+    damage_clips_prop: Option<property::Handle>,
+    buffers: Vec<Buffer>,
+    // the buffer being scanned out, and the one whose flip is still queued
+    front: usize,
+    pending: Option<usize>,
+    back: usize,
+    present_mode: PresentMode,
+    timings: PresentTimings,
+    last_flip: Option<Instant>,
 }
 
 impl DrmBackend {
@@ -75,20 +182,30 @@ impl DrmBackend {
         ))
     }
 
-    pub fn present(&mut self, surface: &mut cairo::ImageSurface) -> Result<()> {
-        let data = surface.data()?;
-        let mut mapping = self.card.map_dumb_buffer(&mut self.db)?;
-        mapping.as_mut()[..data.len()].copy_from_slice(&data);
-        let clip = drm::control::ClipRect::new(0, 0, self.mode.size().0 as u16, self.mode.size().1 as u16);
-        self.card.dirty_framebuffer(self.fb, &[clip])?;
+    fn wait_for_flip(&mut self) -> Result<()> {
+        while let Some(pending) = self.pending {
+            let ready = {
+                let mut fds = [PollFd::new(&self.card, PollFlags::POLLIN)];
+                poll(&mut fds, FLIP_TIMEOUT_MS)?
+            };
+            if ready == 0 {
+                log_warn!("[renderer] Timed out waiting for page flip");
+                self.front = pending;
+                self.pending = None;
+                break;
+            }
+            for event in self.card.receive_events()? {
+                if let Event::PageFlip(flip) = event {
+                    self.front = pending;
+                    self.pending = None;
+                    // the vblank timestamp, on CLOCK_MONOTONIC
+                    self.last_flip = Some(latency::from_monotonic(flip.duration));
+                }
+            }
+        }
         Ok(())
     }
 
-    pub fn get_dimensions(&self) -> (i32, i32) {
-        let (w, h) = self.mode.size();
-        (w as i32, h as i32)
-    }
-
     fn try_open_card(path: &Path) -> Result<Self> {
         let card = Card::open(path)?;
         card.set_client_capability(drm::ClientCapability::Atomic, true)?;
@@ -115,8 +232,16 @@ impl DrmBackend {
         let plane_handle = *card.plane_handles()?.first().ok_or(anyhow!("No planes found"))?;
 
         let (db_width, db_height) = (mode.size().0 as u32, mode.size().1 as u32);
-        let db = card.create_dumb_buffer((db_width, db_height), drm::buffer::DrmFourcc::Xrgb8888, 32)?;
-        let fb = card.add_framebuffer(&db, 24, 32)?;
+        let mut buffers = Vec::with_capacity(SWAP_CHAIN_LENGTH);
+        for _ in 0..SWAP_CHAIN_LENGTH {
+            let mut db = card.create_dumb_buffer((db_width, db_height), drm::buffer::DrmFourcc::Xrgb8888, 32)?;
+            let fb = card.add_framebuffer(&db, 24, 32)?;
+            let mapping = Mapping::new(&card, &mut db)?;
+            buffers.push(Buffer { db, fb, mapping, stale: None });
+        }
+
+        let fb_id_prop = find_prop_id(&card, plane_handle, "FB_ID")?;
+        let damage_clips_prop = find_prop_id(&card, plane_handle, "FB_DAMAGE_CLIPS").ok();
 
         let mut atomic_req = atomic::AtomicModeReq::new();
         let blob = card.create_property_blob(&mode)?;
@@ -124,7 +249,7 @@ impl DrmBackend {
         atomic_req.add_property(con.handle(), find_prop_id(&card, con.handle(), "CRTC_ID")?, property::Value::CRTC(Some(crtc_handle)));
         atomic_req.add_property(crtc_handle, find_prop_id(&card, crtc_handle, "MODE_ID")?, blob);
         atomic_req.add_property(crtc_handle, find_prop_id(&card, crtc_handle, "ACTIVE")?, property::Value::Boolean(true));
-        atomic_req.add_property(plane_handle, find_prop_id(&card, plane_handle, "FB_ID")?, property::Value::Framebuffer(Some(fb)));
+        atomic_req.add_property(plane_handle, fb_id_prop, property::Value::Framebuffer(Some(buffers[0].fb)));
         atomic_req.add_property(plane_handle, find_prop_id(&card, plane_handle, "CRTC_ID")?, property::Value::CRTC(Some(crtc_handle)));
         atomic_req.add_property(plane_handle, find_prop_id(&card, plane_handle, "SRC_X")?, property::Value::UnsignedRange(0));
         atomic_req.add_property(plane_handle, find_prop_id(&card, plane_handle, "SRC_Y")?, property::Value::UnsignedRange(0));
@@ -137,25 +262,302 @@ impl DrmBackend {
 
         card.atomic_commit(AtomicCommitFlags::ALLOW_MODESET, atomic_req)?;
 
-        Ok(DrmBackend { card, mode, db, fb })
+        Ok(DrmBackend {
+            card,
+            mode,
+            plane: plane_handle,
+            fb_id_prop,
+            damage_clips_prop,
+            buffers,
+            front: 0,
+            pending: None,
+            back: 0,
+            present_mode: PresentMode::Direct,
+            timings: PresentTimings::default(),
+            last_flip: None,
+        })
+    }
+}
+
+impl Presenter for DrmBackend {
+    fn get_dimensions(&self) -> (i32, i32) {
+        let (w, h) = self.mode.size();
+        (w as i32, h as i32)
+    }
+
+    // Returns one surface per swap chain buffer, indexed like begin_frame's result.
+    // When possible they wrap the mapped dumb buffers themselves, so presenting
+    // only has to queue a flip. The surfaces borrow memory owned by the backend
+    // and must not outlive it.
+    fn surfaces(&mut self) -> Result<Vec<ImageSurface>> {
+        let (width, height) = self.get_dimensions();
+        let mut direct = Vec::with_capacity(self.buffers.len());
+        for buffer in &self.buffers {
+            let surface = unsafe {
+                ImageSurface::create_for_data_unsafe(buffer.mapping.ptr, Format::Rgb24, width, height, buffer.db.pitch() as i32)
+            };
+            match surface {
+                Ok(surface) => direct.push(surface),
+                Err(e) => {
+                    log_info!("[renderer] Cannot draw into the scanout buffers ({}), using shadow surfaces", e);
+                    self.present_mode = PresentMode::Shadow;
+                    return self.buffers.iter()
+                        .map(|_| Ok(ImageSurface::create(Format::ARgb32, width, height)?))
+                        .collect();
+                }
+            }
+        }
+        self.present_mode = PresentMode::Direct;
+        Ok(direct)
+    }
+
+    // Picks the buffer to draw the next frame into. `damage` is what changed since
+    // the last frame (None for everything); the returned region also covers what the
+    // chosen buffer missed while other buffers were on screen.
+    fn begin_frame(&mut self, damage: Option<&[Rect]>) -> Result<(usize, Option<Vec<Rect>>)> {
+        let back = (self.pending.unwrap_or(self.front) + 1) % self.buffers.len();
+        if self.pending.is_some() && back == self.front {
+            self.wait_for_flip()?;
+        }
+
+        let repaint = match (&self.buffers[back].stale, damage) {
+            (Some(stale), Some(damage)) => Some(merge_columns(stale.iter().chain(damage).copied().collect())),
+            _ => None,
+        };
+        for (index, buffer) in self.buffers.iter_mut().enumerate() {
+            if index == back {
+                buffer.stale = Some(Vec::new());
+            } else if let (Some(stale), Some(damage)) = (&mut buffer.stale, damage) {
+                stale.extend_from_slice(damage);
+                *stale = merge_columns(mem::take(stale));
+            } else {
+                buffer.stale = None;
+            }
+        }
+
+        self.back = back;
+        Ok((back, repaint))
+    }
+
+    // Queues the buffer picked by begin_frame for scanout on the next vblank. Only one
+    // flip can be outstanding, so this waits for the previous one first; that wait is
+    // what paces the render loop to the display.
+    // `damage` is in logical (rotated) coordinates and is passed to the driver as
+    // FB_DAMAGE_CLIPS; a logical column of the strip is a run of whole buffer rows.
+    fn present(&mut self, surface: &mut ImageSurface, repaint: Option<&[Rect]>, damage: Option<&[Rect]>) -> Result<()> {
+        let buffer_height = self.mode.size().1 as i32;
+        let to_rows = |rects: &[Rect]| -> Vec<(i32, i32)> {
+            rects.iter().map(|r| {
+                let first = (r.x.floor() as i32).clamp(0, buffer_height);
+                let last = ((r.x + r.width).ceil() as i32).clamp(0, buffer_height);
+                (first, last)
+            }).filter(|(first, last)| first < last).collect()
+        };
+
+        let copy_start = Instant::now();
+        match self.present_mode {
+            PresentMode::Direct => surface.flush(),
+            PresentMode::Shadow => {
+                let rows = repaint.map_or(vec![(0, buffer_height)], to_rows);
+                let stride = surface.stride() as usize;
+                let buffer = &mut self.buffers[self.back];
+                let pitch = buffer.db.pitch() as usize;
+                let len = stride.min(pitch);
+                let data = surface.data()?;
+                let mapping = buffer.mapping.as_mut();
+                for (first, last) in rows {
+                    for row in first as usize..last as usize {
+                        mapping[row * pitch..row * pitch + len].copy_from_slice(&data[row * stride..row * stride + len]);
+                    }
+                }
+            }
+        }
+
+        let flip_wait_start = Instant::now();
+        self.timings.copy = flip_wait_start - copy_start;
+        self.wait_for_flip()?;
+        let commit_start = Instant::now();
+        self.timings.flip_wait = commit_start - flip_wait_start;
+
+        let mut atomic_req = atomic::AtomicModeReq::new();
+        atomic_req.add_property(self.plane, self.fb_id_prop, property::Value::Framebuffer(Some(self.buffers[self.back].fb)));
+
+        // the driver only needs to push the union of the damaged rows
+        let mut damage_blob = None;
+        if let (Some(prop), Some(damage)) = (self.damage_clips_prop, damage) {
+            let rows = to_rows(damage);
+            if let (Some(first), Some(last)) = (rows.iter().map(|r| r.0).min(), rows.iter().map(|r| r.1).max()) {
+                let clip = DamageClip { x1: 0, y1: first, x2: self.mode.size().0 as i32, y2: last };
+                let blob = self.card.create_property_blob(&clip)?;
+                atomic_req.add_property(self.plane, prop, blob);
+                damage_blob = Some(blob);
+            }
+        }
+
+        let result = self.card.atomic_commit(AtomicCommitFlags::NONBLOCK | AtomicCommitFlags::PAGE_FLIP_EVENT, atomic_req);
+        if let Some(property::Value::Blob(id)) = damage_blob {
+            let _ = self.card.destroy_property_blob(id);
+        }
+        result?;
+        self.timings.commit = commit_start.elapsed();
+
+        self.pending = Some(self.back);
+        Ok(())
+    }
+
+    fn present_timings(&self) -> PresentTimings {
+        self.timings
+    }
+
+    fn wait_idle(&mut self) -> Result<()> {
+        self.wait_for_flip()
+    }
+
+    fn last_flip(&self) -> Option<Instant> {
+        self.last_flip
     }
 }
 
 impl Drop for DrmBackend {
     fn drop(&mut self) {
+        let _ = self.wait_for_flip();
         let _ = self.card.release_master_lock();
-        let _ = self.card.destroy_framebuffer(self.fb);
-        let _ = self.card.destroy_dumb_buffer(self.db);
+        for buffer in self.buffers.drain(..) {
+            let _ = self.card.destroy_framebuffer(buffer.fb);
+            let _ = self.card.destroy_dumb_buffer(buffer.db);
+        }
+    }
+}
+
+// What was on screen last frame, to work out which parts of the strip a new frame changes.
+struct DrawnFrame {
+    page: Page,
+    gesture: Gesture,
+    dynamic_content: Option<(DynamicDrawable, Rect)>,
+    animation_progress: f64,
+}
+
+pub struct DamageTracker {
+    height: f64,
+    last: Option<DrawnFrame>,
+}
+
+fn column(x: f64, width: f64, height: f64) -> Rect {
+    let first = x.floor();
+    Rect { x: first, y: 0.0, width: (x + width).ceil() - first, height }
+}
+
+fn button_column(button: &Button, height: f64) -> Rect {
+    column(button.x, button.width, height)
+}
+
+fn slider_column(slider: &Slider, height: f64) -> Rect {
+    // the handle sticks out past both ends of the track
+    let margin = BUTTON_RADIUS * 1.2 + 2.0;
+    column(slider.x - margin, slider.width + margin * 2.0, height)
+}
+
+impl DamageTracker {
+    pub fn new(height: i32) -> Self {
+        DamageTracker { height: height as f64, last: None }
+    }
+
+    // Returns the logical columns that differ from the last frame, merged and sorted,
+    // or None if the whole strip has to be repainted.
+    pub fn track(
+        &mut self,
+        page: &Page,
+        gesture: &Gesture,
+        dynamic_content: Option<&(DynamicDrawable, Rect)>,
+        animation_progress: f64,
+    ) -> Option<Vec<Rect>> {
+        let damage = self.last.as_ref().and_then(|last| self.diff(last, page, gesture, dynamic_content, animation_progress));
+        self.last = Some(DrawnFrame {
+            page: page.clone(),
+            gesture: gesture.clone(),
+            dynamic_content: dynamic_content.cloned(),
+            animation_progress,
+        });
+        damage.map(merge_columns)
+    }
+
+    fn diff(
+        &self,
+        last: &DrawnFrame,
+        page: &Page,
+        gesture: &Gesture,
+        dynamic_content: Option<&(DynamicDrawable, Rect)>,
+        animation_progress: f64,
+    ) -> Option<Vec<Rect>> {
+        if last.animation_progress != 1.0 || animation_progress != 1.0 {
+            return None;
+        }
+
+        let mut damage = Vec::new();
+        match (&last.page, page) {
+            (Page::Default(a), Page::Default(b)) | (Page::FnKeys(a), Page::FnKeys(b)) if Arc::ptr_eq(a, b) => {
+                let last_active = if let Gesture::ButtonDown { button_index } = last.gesture { Some(button_index) } else { None };
+                let active = if let Gesture::ButtonDown { button_index } = gesture { Some(*button_index) } else { None };
+                if last_active != active {
+                    for index in [last_active, active].into_iter().flatten() {
+                        if let Some(button) = b.get(index) {
+                            damage.push(button_column(button, self.height));
+                        }
+                    }
+                }
+            }
+            (Page::BrightnessSlider(a), Page::BrightnessSlider(b)) | (Page::VolumeSlider(a), Page::VolumeSlider(b))
+                if a.x == b.x && a.width == b.width =>
+            {
+                if a.value != b.value {
+                    damage.push(slider_column(b, self.height));
+                }
+            }
+            _ => return None,
+        }
+
+        match (&last.dynamic_content, dynamic_content) {
+            (None, None) => {}
+            (Some((last_drawable, last_bounds)), Some((drawable, bounds))) if last_bounds == bounds => {
+                let was_dragging = matches!(last.gesture, Gesture::ScrubberDrag { .. });
+                let is_dragging = matches!(gesture, Gesture::ScrubberDrag { .. });
+                // a playing track moves its playhead without the drawable changing
+                if last_drawable != drawable || was_dragging != is_dragging || drawable.next_redraw(bounds).is_some() {
+                    damage.push(column(bounds.x, bounds.width, self.height));
+                }
+            }
+            _ => return None,
+        }
+
+        Some(damage)
     }
 }
 
+fn merge_columns(mut columns: Vec<Rect>) -> Vec<Rect> {
+    columns.sort_by(|a, b| a.x.total_cmp(&b.x));
+    let mut merged: Vec<Rect> = Vec::with_capacity(columns.len());
+    for column in columns {
+        match merged.last_mut() {
+            Some(last) if column.x <= last.x + last.width => {
+                last.width = last.width.max(column.x + column.width - last.x);
+            }
+            _ => merged.push(column),
+        }
+    }
+    merged
+}
+
+// `damage` limits painting to the given logical columns; None repaints everything.
+// `now` is the time the frame shows, which places the playhead of a playing track.
 pub fn draw_ui(
     surface: &ImageSurface,
     page: &Page,
     gesture: &Gesture,
     dynamic_content: Option<(&DynamicDrawable, &Rect)>,
                animation_progress: f64,
+               now: Instant,
                is_screenshot: bool,
+               damage: Option<&[Rect]>,
 ) -> Result<()> {
     let c = cairo::Context::new(surface)?;
     let (width, height) = if is_screenshot {
@@ -169,6 +571,13 @@ pub fn draw_ui(
         c.rotate(90.0f64.to_radians());
     }
 
+    if let Some(damage) = damage {
+        for rect in damage {
+            c.rectangle(rect.x, 0.0, rect.width, height);
+        }
+        c.clip();
+    }
+
     c.set_source_rgb(0.02, 0.02, 0.02);
     c.paint()?;
 
@@ -183,7 +592,7 @@ pub fn draw_ui(
     match page {
         Page::Default(buttons) => {
             if let Some((drawable, bounds)) = dynamic_content {
-                drawable.draw(&c, bounds, is_scrubber_drag)?;
+                drawable.draw(&c, bounds, is_scrubber_drag, now)?;
             }
             for (i, button) in buttons.iter().enumerate() {
                 button.draw(&c, height, active_button_index == Some(i))?;
@@ -196,7 +605,7 @@ pub fn draw_ui(
                 c.save()?;
                 c.rectangle(bounds.x, bounds.y, bounds.width, bounds.height);
                 c.clip();
-                drawable.draw(&c, &animated_bounds, is_scrubber_drag)?;
+                drawable.draw(&c, &animated_bounds, is_scrubber_drag, now)?;
                 c.restore()?;
             }
             for (i, button) in buttons.iter().enumerate() {
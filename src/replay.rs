@@ -0,0 +1,185 @@
+// `dfr_daemon replay <file> [--fast]`: feeds a capture from `dfr_daemon record` through
+// AppState and the offscreen presenter, either at the original pace (animations included)
+// or as fast as it goes. Key presses are written to /dev/null and player commands dropped,
+// so it runs anywhere. AppState only sees the recorded timestamps, and the deadlines the
+// daemon would have woken up for are settled at exactly their time, so the same file
+// drives the same sequence of states at either pace. Only the clock text is live.
+
+use crate::app::{AppState, RenderSnapshot};
+use crate::bench::{PANEL_HEIGHT, PANEL_WIDTH};
+use crate::icons;
+use crate::input::ReplayDecoder;
+use crate::media::MediaInfo;
+use crate::mpris::MediaController;
+use crate::offscreen::OffscreenBackend;
+use crate::record::{Record, Recording};
+use crate::renderer::{self, DamageTracker, Presenter};
+use crate::stats::Histogram;
+use anyhow::Result;
+use cairo::ImageSurface;
+use input_linux::uinput::UInputHandle;
+use std::fs::OpenOptions;
+use std::path::Path;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+const FRAME_DURATION: Duration = Duration::from_millis(16);
+
+// The render thread's half of the daemon, run inline.
+struct Screen {
+    presenter: OffscreenBackend,
+    surfaces: Vec<ImageSurface>,
+    damage_tracker: DamageTracker,
+    frame_times: Histogram,
+    last: Option<RenderSnapshot>,
+}
+
+impl Screen {
+    fn new() -> Result<Self> {
+        let mut presenter = OffscreenBackend::new(PANEL_WIDTH, PANEL_HEIGHT);
+        let surfaces = presenter.surfaces()?;
+        Ok(Screen { presenter, surfaces, damage_tracker: DamageTracker::new(PANEL_WIDTH), frame_times: Histogram::new(), last: None })
+    }
+
+    fn is_animating(&self, now: Instant) -> bool {
+        self.last.as_ref().map_or(false, |snapshot| snapshot.is_animating(now))
+    }
+
+    // Draws the newest snapshot, or the last one again while it is animating.
+    fn draw(&mut self, state: &mut AppState, now: Instant) -> Result<()> {
+        if state.needs_redraw {
+            self.last = Some(state.snapshot());
+            state.needs_redraw = false;
+        } else if !self.is_animating(now) {
+            return Ok(());
+        }
+        let Some(snapshot) = &self.last else { return Ok(()) };
+
+        let start = Instant::now();
+        let progress = snapshot.animation_progress(now);
+        let damage = self.damage_tracker.track(&snapshot.page, &snapshot.gesture, snapshot.dynamic_content.as_ref(), progress);
+        if damage.as_ref().map_or(false, |rects| rects.is_empty()) {
+            return Ok(());
+        }
+        let (back, repaint) = self.presenter.begin_frame(damage.as_deref())?;
+        let surface = &mut self.surfaces[back];
+        renderer::draw_ui(
+            surface,
+            &snapshot.page,
+            &snapshot.gesture,
+            snapshot.dynamic_content.as_ref().map(|(d, r)| (d, r)),
+            progress,
+            now,
+            false,
+            repaint.as_deref(),
+        )?;
+        self.presenter.present(surface, repaint.as_deref(), damage.as_deref())?;
+        self.frame_times.record(start.elapsed());
+        Ok(())
+    }
+}
+
+// What the main loop does after every batch of events; `refresh` is whether the batch
+// brought new media info.
+fn settle(state: &mut AppState, media_info: &Vec<MediaInfo>, now: Instant, refresh: bool, dynamic_inputs: (bool, usize, bool)) {
+    state.update_animations(now);
+    state.close_idle_control_strip(now);
+    if refresh || state.dynamic_inputs() != dynamic_inputs {
+        state.refresh_dynamic(media_info);
+    }
+}
+
+// The next time the main loop would wake up without an event.
+fn next_deadline(state: &AppState) -> Option<Instant> {
+    [state.animation_deadline(), state.control_strip_deadline()].into_iter().flatten().min()
+}
+
+// At the original pace, keeps a running animation on screen until `until`, like the
+// render thread would. These frames only show the state, they never change it.
+fn wait_until(screen: &mut Screen, state: &mut AppState, until: Instant) -> Result<()> {
+    while let Some(wait) = until.checked_duration_since(Instant::now()) {
+        if screen.is_animating(Instant::now()) {
+            screen.draw(state, Instant::now())?;
+            thread::sleep(wait.min(FRAME_DURATION));
+        } else {
+            thread::sleep(wait);
+        }
+    }
+    Ok(())
+}
+
+pub fn run(path: &Path, fast: bool) -> Result<()> {
+    let mut recording = Recording::open(path)?;
+    let (logical_width, logical_height) = (PANEL_HEIGHT, PANEL_WIDTH);
+    icons::init(logical_height)?;
+
+    let start = Instant::now();
+    let mut state = AppState::new(logical_width, logical_height, recording.has_physical_esc, &Vec::new(), start)?;
+    let latest_media_info = Arc::new(Mutex::new(Vec::<MediaInfo>::new()));
+    let media_controller = MediaController::detached();
+    let mut uinput = UInputHandle::new(OpenOptions::new().write(true).open("/dev/null")?);
+    let mut screen = Screen::new()?;
+    let mut decoder = ReplayDecoder::default();
+
+    let mut input_events = 0;
+    let mut media_updates = 0;
+    let mut recorded = Duration::ZERO;
+    screen.draw(&mut state, start)?;
+
+    while let Some((time, record)) = recording.next()? {
+        recorded = time;
+        let now = start + time;
+        // animations ending and the control strip closing in between happen on time
+        while let Some(deadline) = next_deadline(&state).filter(|deadline| *deadline <= now) {
+            if !fast {
+                wait_until(&mut screen, &mut state, deadline)?;
+            }
+            let dynamic_inputs = state.dynamic_inputs();
+            settle(&mut state, &latest_media_info.lock().unwrap(), deadline, false, dynamic_inputs);
+            screen.draw(&mut state, deadline)?;
+        }
+        if !fast {
+            wait_until(&mut screen, &mut state, now)?;
+        }
+
+        let dynamic_inputs = state.dynamic_inputs();
+        let is_media = matches!(record, Record::Media(_));
+        let event = match record {
+            Record::Touch { kind, code, value } => decoder.touch(kind, code, value),
+            Record::Keyboard { kind, code, value } => decoder.keyboard(kind, code, value),
+            Record::Media(mut media_info) => {
+                // positions were written as of the record's time
+                for info in &mut media_info {
+                    info.set_position_sample(info.position_usecs(), now, info.rate);
+                }
+                *latest_media_info.lock().unwrap() = media_info;
+                media_updates += 1;
+                None
+            }
+        };
+        if let Some(event) = event {
+            state.handle_event(event, now, &mut uinput, &latest_media_info, &media_controller)?;
+            input_events += 1;
+        }
+        settle(&mut state, &latest_media_info.lock().unwrap(), now, is_media, dynamic_inputs);
+        screen.draw(&mut state, now)?;
+    }
+
+    let frames = &screen.frame_times;
+    println!(
+        "[replay] {} input events and {} media updates from {:.1} s of recording, replayed in {:.1} s",
+        input_events,
+        media_updates,
+        recorded.as_secs_f64(),
+        start.elapsed().as_secs_f64(),
+    );
+    println!(
+        "[replay] {} frames drawn, p50 {} us, p99 {} us, max {} us",
+        frames.count(),
+        frames.percentile(0.5),
+        frames.percentile(0.99),
+        frames.max(),
+    );
+    Ok(())
+}
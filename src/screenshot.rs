@@ -6,6 +6,7 @@ use cairo::{Format, ImageSurface};
 use std::fs::File;
 use std::path::PathBuf;
 use std::sync::Arc;
+use std::time::Instant;
 
 fn get_screenshot_path() -> Result<PathBuf> {
     let pictures_dir = dirs::picture_dir()
@@ -22,12 +23,13 @@ fn get_screenshot_path() -> Result<PathBuf> {
 
 pub fn take_screenshot(state: &AppState) -> Result<()> {
     let path = get_screenshot_path()?;
-    println!("[screenshot] Saving to {}", path.display());
+    log_info!("[screenshot] Saving to {}", path.display());
 
     let (width, height) = (state.width, state.height);
     let mut surface = ImageSurface::create(Format::ARgb32, width, height)?;
 
-    let animation_progress = state.get_animation_progress();
+    let now = Instant::now();
+    let animation_progress = state.get_animation_progress(now);
 
     let dynamic_content = if let Page::Default(layout) = &state.page {
         if Arc::ptr_eq(layout, &state.default_layout) {
@@ -39,11 +41,11 @@ pub fn take_screenshot(state: &AppState) -> Result<()> {
         None
     };
 
-    renderer::draw_ui(&mut surface, &state.page, &state.gesture, dynamic_content, animation_progress, true)?;
+    renderer::draw_ui(&mut surface, &state.page, &state.gesture, dynamic_content, animation_progress, now, true, None)?;
 
     let mut file = File::create(path)?;
     surface.write_to_png(&mut file)?;
 
-    println!("[screenshot] Screenshot saved successfully.");
+    log_info!("[screenshot] Screenshot saved successfully.");
     Ok(())
 }
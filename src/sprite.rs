@@ -0,0 +1,84 @@
+use anyhow::{anyhow, Result};
+use cairo::{Context, Format, ImageSurface};
+use tiny_skia::Pixmap;
+
+// A pre-rendered ARGB32 image. Unlike a cairo surface it can be shared between the thread
+// that builds layouts and the render thread, and it is painted without copying its pixels.
+pub struct Sprite {
+    data: Box<[u8]>,
+    width: i32,
+    height: i32,
+    stride: i32,
+}
+
+impl std::fmt::Debug for Sprite {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "Sprite({}x{})", self.width, self.height)
+    }
+}
+
+impl Sprite {
+    // Renders `draw` into a fresh transparent surface and keeps the result.
+    pub fn render(width: i32, height: i32, draw: impl FnOnce(&Context) -> Result<()>) -> Result<Self> {
+        let mut surface = ImageSurface::create(Format::ARgb32, width.max(1), height.max(1))?;
+        {
+            let c = Context::new(&surface)?;
+            draw(&c)?;
+        }
+        surface.flush();
+        let stride = surface.stride();
+        let data = surface.data()?.to_vec().into_boxed_slice();
+        Ok(Sprite { data, width: width.max(1), height: height.max(1), stride })
+    }
+
+    // tiny-skia pixmaps are premultiplied RGBA, cairo wants premultiplied BGRA.
+    pub fn from_pixmap(pixmap: &Pixmap) -> Result<Self> {
+        let width = pixmap.width() as i32;
+        let stride = Format::ARgb32.stride_for_width(pixmap.width()).map_err(|e| anyhow!("Invalid sprite width: {}", e))?;
+        let mut data = vec![0u8; (stride * pixmap.height() as i32) as usize];
+        for (y, row) in pixmap.data().chunks(width as usize * 4).enumerate() {
+            let line = &mut data[y * stride as usize..y * stride as usize + row.len()];
+            line.copy_from_slice(row);
+            for chunk in line.chunks_mut(4) {
+                chunk.swap(0, 2); // BGRA -> ARGB
+            }
+        }
+        Ok(Sprite { data: data.into_boxed_slice(), width, height: pixmap.height() as i32, stride })
+    }
+
+    pub fn width(&self) -> i32 {
+        self.width
+    }
+
+    pub fn height(&self) -> i32 {
+        self.height
+    }
+
+    fn with_surface<T>(&self, f: impl FnOnce(&ImageSurface) -> Result<T>) -> Result<T> {
+        // SAFETY: the surface never outlives this call and is only ever used as a source or a mask,
+        // so cairo reads the pixels but does not write them.
+        let surface = unsafe {
+            ImageSurface::create_for_data_unsafe(self.data.as_ptr() as *mut u8, Format::ARgb32, self.width, self.height, self.stride)?
+        };
+        let result = f(&surface);
+        surface.finish();
+        result
+    }
+
+    pub fn paint(&self, c: &Context, x: f64, y: f64) -> Result<()> {
+        self.with_surface(|surface| {
+            c.set_source_surface(surface, x, y)?;
+            c.paint()?;
+            // drop the context's reference to the borrowed pixels
+            c.set_source_rgb(0.0, 0.0, 0.0);
+            Ok(())
+        })
+    }
+
+    pub fn mask(&self, c: &Context, x: f64, y: f64) -> Result<()> {
+        self.with_surface(|surface| {
+            c.mask_surface(surface, x, y)?;
+            Ok(())
+        })
+    }
+}
@@ -0,0 +1,216 @@
+// Per-stage timing of the render loop and touch-to-photon latency, kept as log-linear
+// histograms so a long-running daemon can report p50/p99 in fixed memory. Anyone can
+// read a report from the stats socket, e.g. `socat - UNIX-CONNECT:/run/dfr_daemon.stats`.
+
+use crate::latency::LatencyBreakdown;
+use anyhow::Result;
+use std::fmt::Write as _;
+use std::fs;
+use std::io::Write;
+use std::os::unix::fs::PermissionsExt;
+use std::os::unix::net::UnixListener;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+pub const SOCKET_PATH: &str = "/run/dfr_daemon.stats";
+
+// Values below SUB_BUCKETS microseconds get a bucket each; above that, every power of two
+// is split into SUB_BUCKETS buckets, which keeps the error of a reported value under 7%.
+const SUB_BUCKETS: u64 = 16;
+const SUB_BUCKET_BITS: u32 = 4;
+// up to 2^26 us, about a minute; anything longer lands in the last bucket
+const MAX_MAGNITUDE: u32 = 26;
+const BUCKETS: usize = (SUB_BUCKETS * (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) as u64) as usize;
+
+pub struct Histogram {
+    counts: Box<[u64; BUCKETS]>,
+    total: u64,
+    max: u64,
+}
+
+fn bucket_index(us: u64) -> usize {
+    if us < SUB_BUCKETS {
+        return us as usize;
+    }
+    let magnitude = (63 - us.leading_zeros()).min(MAX_MAGNITUDE);
+    let sub = ((us >> (magnitude - SUB_BUCKET_BITS)) - SUB_BUCKETS).min(SUB_BUCKETS - 1);
+    (SUB_BUCKETS * (magnitude - SUB_BUCKET_BITS + 1) as u64 + sub) as usize
+}
+
+// The smallest value that lands in bucket `index`.
+fn bucket_value(index: usize) -> u64 {
+    let index = index as u64;
+    if index < SUB_BUCKETS {
+        return index;
+    }
+    let magnitude = (index / SUB_BUCKETS) as u32 + SUB_BUCKET_BITS - 1;
+    (SUB_BUCKETS + index % SUB_BUCKETS) << (magnitude - SUB_BUCKET_BITS)
+}
+
+impl Histogram {
+    pub fn new() -> Self {
+        Histogram { counts: Box::new([0; BUCKETS]), total: 0, max: 0 }
+    }
+
+    pub fn record(&mut self, duration: Duration) {
+        let us = duration.as_micros().min(u64::MAX as u128) as u64;
+        self.counts[bucket_index(us)] += 1;
+        self.total += 1;
+        self.max = self.max.max(us);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.total
+    }
+
+    // In microseconds, like percentile.
+    pub fn max(&self) -> u64 {
+        self.max
+    }
+
+    // In microseconds.
+    pub fn percentile(&self, p: f64) -> u64 {
+        let rank = ((self.total as f64 * p).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return bucket_value(index).min(self.max);
+            }
+        }
+        self.max
+    }
+}
+
+#[derive(Clone, Copy)]
+pub enum Stage {
+    // picking up the newest snapshot from the main thread
+    Snapshot,
+    // working out what changed since the last frame
+    Damage,
+    // getting a buffer to draw into, which waits for a flip when all of them are queued
+    Acquire,
+    Draw,
+    // copying a shadow surface into the scanout buffer
+    Copy,
+    // waiting for the previous page flip before queueing this one
+    FlipWait,
+    // the atomic commit ioctl
+    Commit,
+    // all of the above
+    Frame,
+}
+
+const STAGES: [(Stage, &str); 8] = [
+    (Stage::Snapshot, "snapshot"),
+    (Stage::Damage, "damage"),
+    (Stage::Acquire, "acquire"),
+    (Stage::Draw, "draw"),
+    (Stage::Copy, "copy"),
+    (Stage::FlipWait, "flip_wait"),
+    (Stage::Commit, "commit"),
+    (Stage::Frame, "frame"),
+];
+
+const LATENCY_STAGES: [&str; 6] = ["input", "state", "handoff", "render", "scanout", "total"];
+
+pub struct FrameStats {
+    stages: Vec<Histogram>,
+    // touch to photon, split like LATENCY_STAGES
+    latency: Vec<Histogram>,
+    frames: u64,
+    // frames whose own work, not counting waits for vblank, took longer than a refresh interval
+    late_frames: u64,
+    // wakeups of the render thread that found nothing to draw
+    idle_wakeups: u64,
+    started: Instant,
+    // frames drawn in the last complete second, and the one being counted
+    frames_per_second: u64,
+    second_start: Instant,
+    frames_this_second: u64,
+}
+
+impl FrameStats {
+    pub fn new() -> Self {
+        FrameStats {
+            stages: STAGES.iter().map(|_| Histogram::new()).collect(),
+            latency: LATENCY_STAGES.iter().map(|_| Histogram::new()).collect(),
+            frames: 0,
+            late_frames: 0,
+            idle_wakeups: 0,
+            started: Instant::now(),
+            frames_per_second: 0,
+            second_start: Instant::now(),
+            frames_this_second: 0,
+        }
+    }
+
+    pub fn record(&mut self, stage: Stage, duration: Duration) {
+        self.stages[stage as usize].record(duration);
+    }
+
+    pub fn frame_done(&mut self, duration: Duration, late: bool) {
+        self.record(Stage::Frame, duration);
+        self.frames += 1;
+        if late {
+            self.late_frames += 1;
+        }
+        let now = Instant::now();
+        if now.duration_since(self.second_start) >= Duration::from_secs(1) {
+            self.frames_per_second = self.frames_this_second;
+            self.frames_this_second = 0;
+            self.second_start = now;
+        }
+        self.frames_this_second += 1;
+    }
+
+    pub fn record_latency(&mut self, breakdown: &LatencyBreakdown) {
+        let durations = [breakdown.input, breakdown.state, breakdown.handoff, breakdown.render, breakdown.scanout, breakdown.total];
+        for (histogram, duration) in self.latency.iter_mut().zip(durations) {
+            histogram.record(duration);
+        }
+    }
+
+    pub fn idle_wakeup(&mut self) {
+        self.idle_wakeups += 1;
+    }
+
+    fn report(&self) -> String {
+        let mut out = String::new();
+        let _ = writeln!(out, "uptime_s {}", self.started.elapsed().as_secs());
+        let _ = writeln!(out, "frames {}", self.frames);
+        let _ = writeln!(out, "frames_per_s {}", self.frames_per_second);
+        let _ = writeln!(out, "late_frames {}", self.late_frames);
+        let _ = writeln!(out, "idle_wakeups {}", self.idle_wakeups);
+        let _ = writeln!(out, "{:<10} {:>8} {:>8} {:>8}", "stage", "p50_us", "p99_us", "max_us");
+        for (stage, name) in STAGES {
+            let histogram = &self.stages[stage as usize];
+            let _ = writeln!(out, "{:<10} {:>8} {:>8} {:>8}", name, histogram.percentile(0.5), histogram.percentile(0.99), histogram.max);
+        }
+        let _ = writeln!(out, "inputs_traced {}", self.latency[LATENCY_STAGES.len() - 1].total);
+        let _ = writeln!(out, "{:<10} {:>8} {:>8} {:>8}", "latency", "p50_us", "p99_us", "max_us");
+        for (histogram, name) in self.latency.iter().zip(LATENCY_STAGES) {
+            let _ = writeln!(out, "{:<10} {:>8} {:>8} {:>8}", name, histogram.percentile(0.5), histogram.percentile(0.99), histogram.max);
+        }
+        out
+    }
+}
+
+// Serves a report to every connection on SOCKET_PATH.
+pub fn start_stats_server(stats: Arc<Mutex<FrameStats>>) -> Result<()> {
+    let _ = fs::remove_file(SOCKET_PATH);
+    let listener = UnixListener::bind(SOCKET_PATH)?;
+    // timings aren't sensitive, and the daemon runs as root
+    fs::set_permissions(SOCKET_PATH, fs::Permissions::from_mode(0o666))?;
+    log_info!("[stats] Serving frame stats on {}", SOCKET_PATH);
+
+    thread::spawn(move || {
+        for stream in listener.incoming() {
+            let Ok(mut stream) = stream else { continue };
+            let report = stats.lock().unwrap().report();
+            let _ = stream.write_all(report.as_bytes());
+        }
+    });
+    Ok(())
+}
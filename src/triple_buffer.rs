@@ -0,0 +1,61 @@
+// A single-producer, single-consumer triple buffer. The writer always owns a slot to fill
+// and the reader always owns a slot to look at, so neither ever waits for the other:
+// publishing and picking up a value are each one atomic swap of the shared middle slot.
+
+use std::cell::UnsafeCell;
+use std::sync::atomic::{AtomicU8, Ordering};
+use std::sync::Arc;
+
+const INDEX_MASK: u8 = 0b011;
+// set on the middle index when it holds a value the reader hasn't picked up yet
+const FRESH: u8 = 0b100;
+
+struct Shared<T> {
+    slots: [UnsafeCell<Option<T>>; 3],
+    middle: AtomicU8,
+}
+
+// Each slot is only ever touched by whichever side currently owns its index.
+unsafe impl<T: Send> Sync for Shared<T> {}
+
+pub struct Writer<T> {
+    shared: Arc<Shared<T>>,
+    back: u8,
+}
+
+pub struct Reader<T> {
+    shared: Arc<Shared<T>>,
+    front: u8,
+}
+
+pub fn triple_buffer<T>() -> (Writer<T>, Reader<T>) {
+    let shared = Arc::new(Shared {
+        slots: [UnsafeCell::new(None), UnsafeCell::new(None), UnsafeCell::new(None)],
+        middle: AtomicU8::new(1),
+    });
+    (Writer { shared: Arc::clone(&shared), back: 0 }, Reader { shared, front: 2 })
+}
+
+impl<T> Writer<T> {
+    pub fn publish(&mut self, value: T) {
+        unsafe { *self.shared.slots[self.back as usize].get() = Some(value) };
+        let previous = self.shared.middle.swap(self.back | FRESH, Ordering::AcqRel);
+        self.back = previous & INDEX_MASK;
+    }
+}
+
+impl<T> Reader<T> {
+    // Moves to the newest published value. Returns false if there was nothing new.
+    pub fn update(&mut self) -> bool {
+        if self.shared.middle.load(Ordering::Acquire) & FRESH == 0 {
+            return false;
+        }
+        let previous = self.shared.middle.swap(self.front, Ordering::AcqRel);
+        self.front = previous & INDEX_MASK;
+        true
+    }
+
+    pub fn get(&self) -> Option<&T> {
+        unsafe { (*self.shared.slots[self.front as usize].get()).as_ref() }
+    }
+}
@@ -1,17 +1,23 @@
 use anyhow::{Result, anyhow};
 use cairo::Context;
 use input_linux::Key;
+use crate::app::AppEvent;
 use crate::config::{Layout, ButtonRenderMode};
 use crate::dynamic::Rect;
+use crate::icons;
 use crate::media::MediaInfo;
+use crate::sprite::Sprite;
+use std::collections::{HashMap, HashSet};
 use std::fs::File;
 use std::env;
 use std::path::PathBuf;
+use std::sync::mpsc::Sender;
 use std::sync::Arc;
+use std::thread;
 use usvg::Tree;
 use tiny_skia::{Pixmap, Transform};
 
-fn find_resource_path(file_name: &str) -> Result<PathBuf> {
+pub fn find_resource_path(file_name: &str) -> Result<PathBuf> {
     let mut exe_path = env::current_exe()?;
     exe_path.pop();
     let mut resource_path = exe_path.clone();
@@ -47,6 +53,13 @@ pub enum RoundedCorners {
     None,
 }
 
+// A button's complete rendering in both states, so drawing a page is a series of blits.
+#[derive(Debug)]
+pub struct ButtonSprites {
+    inactive: Sprite,
+    active: Sprite,
+}
+
 #[derive(Clone, Debug)]
 pub struct Button {
     pub content: ButtonContent,
@@ -55,37 +68,58 @@ pub struct Button {
     pub width: f64,
     pub rounded_corners: RoundedCorners,
     pub render_mode: ButtonRenderMode,
+    pub sprites: Option<Arc<ButtonSprites>>,
 }
 
 pub const BUTTON_RADIUS: f64 = 8.0;
 
 impl Button {
     pub fn draw(&self, c: &Context, height: f64, is_active: bool) -> Result<()> {
+        match &self.sprites {
+            Some(sprites) if sprites.inactive.height() == height as i32 => {
+                let sprite = if is_active { &sprites.active } else { &sprites.inactive };
+                sprite.paint(c, self.x.floor(), 0.0)
+            }
+            _ => self.render(c, self.x, height, is_active),
+        }
+    }
+
+    // Sprites are rendered at the button's sub-pixel offset and blitted at the whole pixel below it.
+    pub fn build_sprites(&mut self, height: i32) -> Result<()> {
+        let offset = self.x - self.x.floor();
+        let width = (offset + self.width).ceil() as i32;
+        let inactive = Sprite::render(width, height, |c| self.render(c, offset, height as f64, false))?;
+        let active = Sprite::render(width, height, |c| self.render(c, offset, height as f64, true))?;
+        self.sprites = Some(Arc::new(ButtonSprites { inactive, active }));
+        Ok(())
+    }
+
+    fn render(&self, c: &Context, x: f64, height: f64, is_active: bool) -> Result<()> {
         let color = if is_active { BUTTON_COLOR_ACTIVE } else { BUTTON_COLOR_INACTIVE };
         c.set_source_rgb(color, color, color);
 
         c.new_path();
         match self.rounded_corners {
             RoundedCorners::All => {
-                c.arc(self.x + BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, 180.0f64.to_radians(), 270.0f64.to_radians());
-                c.arc(self.x + self.width - BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, -90.0f64.to_radians(), 0.0f64.to_radians());
-                c.arc(self.x + self.width - BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 0.0f64.to_radians(), 90.0f64.to_radians());
-                c.arc(self.x + BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 90.0f64.to_radians(), 180.0f64.to_radians());
+                c.arc(x + BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, 180.0f64.to_radians(), 270.0f64.to_radians());
+                c.arc(x + self.width - BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, -90.0f64.to_radians(), 0.0f64.to_radians());
+                c.arc(x + self.width - BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 0.0f64.to_radians(), 90.0f64.to_radians());
+                c.arc(x + BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 90.0f64.to_radians(), 180.0f64.to_radians());
             }
             RoundedCorners::Left => {
-                c.arc(self.x + BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, 180.0f64.to_radians(), 270.0f64.to_radians());
-                c.line_to(self.x + self.width, 0.0);
-                c.line_to(self.x + self.width, height);
-                c.arc(self.x + BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 90.0f64.to_radians(), 180.0f64.to_radians());
+                c.arc(x + BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, 180.0f64.to_radians(), 270.0f64.to_radians());
+                c.line_to(x + self.width, 0.0);
+                c.line_to(x + self.width, height);
+                c.arc(x + BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 90.0f64.to_radians(), 180.0f64.to_radians());
             }
             RoundedCorners::Right => {
-                c.move_to(self.x, 0.0);
-                c.arc(self.x + self.width - BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, -90.0f64.to_radians(), 0.0f64.to_radians());
-                c.arc(self.x + self.width - BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 0.0f64.to_radians(), 90.0f64.to_radians());
-                c.line_to(self.x, height);
+                c.move_to(x, 0.0);
+                c.arc(x + self.width - BUTTON_RADIUS, BUTTON_RADIUS, BUTTON_RADIUS, -90.0f64.to_radians(), 0.0f64.to_radians());
+                c.arc(x + self.width - BUTTON_RADIUS, height - BUTTON_RADIUS, BUTTON_RADIUS, 0.0f64.to_radians(), 90.0f64.to_radians());
+                c.line_to(x, height);
             }
             RoundedCorners::None => {
-                c.rectangle(self.x, 0.0, self.width, height);
+                c.rectangle(x, 0.0, self.width, height);
             }
         }
         c.close_path();
@@ -96,7 +130,7 @@ impl Button {
         match &self.content {
             ButtonContent::Text(text) => {
                 let extents = c.text_extents(text)?;
-                let text_x = self.x + (self.width / 2.0) - (extents.width() / 2.0);
+                let text_x = x + (self.width / 2.0) - (extents.width() / 2.0);
                 let mut text_y = (height / 2.0) + (extents.height() / 2.0);
                 if text == "Apps" {
                     text_y -= 4.0;
@@ -106,7 +140,7 @@ impl Button {
             }
             ButtonContent::Icon(tree) => {
                 let icon_size = height * 0.6;
-                let icon_x = self.x + (self.width - icon_size) / 2.0;
+                let icon_x = x + (self.width - icon_size) / 2.0;
                 let icon_y = (height - icon_size) / 2.0;
 
                 let mut pixmap = Pixmap::new(icon_size as u32, icon_size as u32).unwrap();
@@ -202,36 +236,15 @@ impl Slider {
             c.arc(handle_x, height / 2.0, BUTTON_RADIUS * 1.2, 0.0, 2.0 * std::f64::consts::PI);
             c.fill()?;
 
-            let mut exe_path = env::current_exe()?;
-            exe_path.pop();
-
             let (icon_left_name, icon_right_name) = match self.kind {
                 SliderKind::Brightness => ("brightness-low.svg", "brightness-high.svg"),
                 SliderKind::Volume => ("volume-low.svg", "volume-high.svg"),
             };
 
+            let icon_size = height * 0.6;
+            let icon_y = (height - icon_size) / 2.0;
             for (icon_name, side) in [(icon_left_name, -1), (icon_right_name, 1)] {
-                let icon_path = find_resource_path(&format!("icons/{}", icon_name))?;
-                let svg_data = std::fs::read(icon_path)?;
-                let tree = Tree::from_data(&svg_data, &usvg::Options::default())?;
-
-                let icon_size = height * 0.6;
-                let icon_y = (height - icon_size) / 2.0;
-
-                let mut pixmap = Pixmap::new(icon_size as u32, icon_size as u32).unwrap();
-                let transform = Transform::from_scale(
-                    icon_size as f32 / tree.size().width(),
-                                                      icon_size as f32 / tree.size().height(),
-                );
-                resvg::render(&tree, transform, &mut pixmap.as_mut());
-
-                let surface = cairo::ImageSurface::create_for_data(
-                    pixmap.data().to_vec().into_boxed_slice(),
-                                                                   cairo::Format::ARgb32,
-                                                                   icon_size as i32,
-                                                                   icon_size as i32,
-                                                                   cairo::Format::ARgb32.stride_for_width(icon_size as u32).unwrap(),
-                )?;
+                let mask = icons::atlas().mask(icon_name, icons::icon_size(height))?;
 
                 let icon_x = if side == -1 {
                     animated_x + 10.0
@@ -240,7 +253,7 @@ impl Slider {
                 };
 
                 c.set_source_rgba(1.0, 1.0, 1.0, alpha);
-                c.mask_surface(&surface, icon_x, icon_y)?;
+                mask.mask(c, icon_x, icon_y)?;
             }
         }
 
@@ -271,24 +284,108 @@ pub enum Page {
     MediaInfoHiding(Arc<Vec<Button>>),
 }
 
-pub fn create_default_layout(width: i32, height: i32, has_physical_esc: bool, media_info: &Vec<MediaInfo>) -> Result<(Vec<Button>, Rect)> {
-    let layout_path = find_resource_path("layout.yml")?;
-    let f = File::open(layout_path)?;
-    let layout: Layout = serde_yaml::from_reader(f)?;
+// layout.yml parsed once, plus every variant of the default layout built from it so far.
+// A player appearing or going away then just picks a prebuilt variant; only a player
+// icon never seen before costs an icon lookup, which the daemon does off the main thread.
+#[derive(Debug)]
+pub struct LayoutCompiler {
+    layout: Arc<Layout>,
+    width: i32,
+    height: i32,
+    has_physical_esc: bool,
+    // keyed by the media button's icon, None for the layout without one
+    variants: HashMap<Option<String>, (Arc<Vec<Button>>, Rect)>,
+    // handed to build_in_background and not back yet, or failed to build
+    requested: HashSet<Option<String>>,
+}
+
+// A default layout variant built by LayoutCompiler::build_in_background.
+#[derive(Debug)]
+pub struct LayoutVariant {
+    layout: Arc<Layout>,
+    media_icon: Option<String>,
+    built: Result<(Vec<Button>, Rect)>,
+}
+
+fn media_icon(media_info: &[MediaInfo]) -> Option<String> {
+    media_info.first().map(|m| m.icon_name.clone()).filter(|name| !name.is_empty())
+}
+
+impl LayoutCompiler {
+    pub fn new(width: i32, height: i32, has_physical_esc: bool) -> Result<Self> {
+        let layout_path = find_resource_path("layout.yml")?;
+        let f = File::open(layout_path)?;
+        let layout: Layout = serde_yaml::from_reader(f)?;
+        let mut compiler = LayoutCompiler {
+            layout: Arc::new(layout),
+            width,
+            height,
+            has_physical_esc,
+            variants: HashMap::new(),
+            requested: HashSet::new(),
+        };
+        compiler.default_layout(&[])?;
+        Ok(compiler)
+    }
+
+    // Builds the variant right here if it's new.
+    pub fn default_layout(&mut self, media_info: &[MediaInfo]) -> Result<(Arc<Vec<Button>>, Rect)> {
+        if let Some(variant) = self.cached(media_info) {
+            return Ok(variant);
+        }
+        let media_icon = media_icon(media_info);
+        let (buttons, bounds) = create_default_layout(&self.layout, self.width, self.height, self.has_physical_esc, media_icon.as_deref())?;
+        let buttons = Arc::new(buttons);
+        self.variants.insert(media_icon, (Arc::clone(&buttons), bounds));
+        Ok((buttons, bounds))
+    }
+
+    pub fn cached(&self, media_info: &[MediaInfo]) -> Option<(Arc<Vec<Button>>, Rect)> {
+        self.variants.get(&media_icon(media_info)).map(|(buttons, bounds)| (Arc::clone(buttons), *bounds))
+    }
+
+    // Builds a new variant on a thread of its own, since a player icon from the system
+    // theme means file I/O and rasterizing, and sends it as LayoutVariantBuilt.
+    pub fn build_in_background(&mut self, media_info: &[MediaInfo], tx: &Sender<AppEvent>) {
+        let media_icon = media_icon(media_info);
+        if self.variants.contains_key(&media_icon) || !self.requested.insert(media_icon.clone()) {
+            return;
+        }
+        let (layout, width, height, has_physical_esc) = (Arc::clone(&self.layout), self.width, self.height, self.has_physical_esc);
+        let tx = tx.clone();
+        thread::spawn(move || {
+            let built = create_default_layout(&layout, width, height, has_physical_esc, media_icon.as_deref());
+            let _ = tx.send(AppEvent::LayoutVariantBuilt(LayoutVariant { layout, media_icon, built }));
+        });
+    }
+
+    // Keeps a variant from build_in_background, unless layout.yml was reloaded meanwhile.
+    pub fn insert(&mut self, variant: LayoutVariant) {
+        if !Arc::ptr_eq(&variant.layout, &self.layout) {
+            return;
+        }
+        match variant.built {
+            Ok((buttons, bounds)) => {
+                self.requested.remove(&variant.media_icon);
+                self.variants.insert(variant.media_icon, (Arc::new(buttons), bounds));
+            }
+            // stays requested, so it isn't tried again until the layouts are reloaded
+            Err(e) => log_error!("[ui] Failed to build the layout for {:?}: {}", variant.media_icon, e),
+        }
+    }
+}
 
+fn create_default_layout(layout: &Layout, width: i32, height: i32, has_physical_esc: bool, media_icon: Option<&str>) -> Result<(Vec<Button>, Rect)> {
     let mut buttons = Vec::new();
     let mut current_x = 0.0;
 
-    let left_buttons_config: Vec<_> = layout.left.buttons.into_iter().filter(|b| {
+    let left_buttons_config: Vec<_> = layout.left.buttons.iter().filter(|b| {
         !(string_to_key(&b.action) == Key::Esc && has_physical_esc)
-    }).collect();
+    }).cloned().collect();
 
     for button_config in left_buttons_config {
         let content = if let Some(icon_name) = &button_config.icon {
-            let icon_path = find_resource_path(&format!("icons/{}", icon_name))?;
-            let svg_data = std::fs::read(icon_path)?;
-            let tree = Tree::from_data(&svg_data, &usvg::Options::default())?;
-            ButtonContent::Icon(Arc::new(tree))
+            ButtonContent::Icon(icons::atlas().tree(icon_name)?)
         } else {
             ButtonContent::Text(button_config.text.clone().unwrap_or_default())
         };
@@ -300,27 +397,25 @@ pub fn create_default_layout(width: i32, height: i32, has_physical_esc: bool, me
                      width: button_config.width,
                      rounded_corners: RoundedCorners::All,
             render_mode: button_config.render_mode.clone(),
+            sprites: None,
         });
         current_x += button_config.width + layout.left.spacing;
     }
 
     let left_buttons_end_x = if current_x > 0.0 { current_x - layout.left.spacing } else { 0.0 };
 
-    let mut right_buttons_config: Vec<_> = layout.right.buttons.into_iter().filter(|b| {
+    let mut right_buttons_config: Vec<_> = layout.right.buttons.iter().filter(|b| {
         !(string_to_key(&b.action) == Key::Esc && has_physical_esc)
-    }).collect();
-
-    if !media_info.is_empty() {
-        let media = &media_info[0];
-        if !media.icon_name.is_empty() {
-            right_buttons_config.insert(1, crate::config::ButtonConfig {
-                text: None,
-                icon: Some(media.icon_name.clone()),
-                action: "KEY_TOGGLE_MEDIA".to_string(),
-                width: 80.0,
-                render_mode: ButtonRenderMode::Color,
-            });
-        }
+    }).cloned().collect();
+
+    if let Some(media_icon) = media_icon {
+        right_buttons_config.insert(1, crate::config::ButtonConfig {
+            text: None,
+            icon: Some(media_icon.to_string()),
+            action: "KEY_TOGGLE_MEDIA".to_string(),
+            width: 80.0,
+            render_mode: ButtonRenderMode::Color,
+        });
     }
 
     let right_buttons_width: f64 = right_buttons_config.iter().map(|b| b.width).sum::<f64>()
@@ -331,13 +426,16 @@ pub fn create_default_layout(width: i32, height: i32, has_physical_esc: bool, me
     let num_right_buttons = right_buttons_config.len();
     for (i, button_config) in right_buttons_config.iter().enumerate() {
         let content = if let Some(icon_name) = &button_config.icon {
-            let icon_path = crate::dynamic::find_icon_path(icon_name)
-                .or_else(|| find_resource_path(&format!("icons/{}", icon_name)).ok())
-                .or_else(|| find_resource_path("icons/media.svg").ok())
-                .ok_or_else(|| anyhow!("Could not find icon for {} or fallback media.svg", icon_name))?;
-            let svg_data = std::fs::read(icon_path)?;
-            let tree = Tree::from_data(&svg_data, &usvg::Options::default())?;
-            ButtonContent::Icon(Arc::new(tree))
+            // bundled icons come from the atlas, media player icons from the system theme
+            let tree = match icons::atlas().tree(icon_name) {
+                Ok(tree) => tree,
+                Err(_) => match crate::dynamic::find_icon_path(icon_name) {
+                    Some(icon_path) => Arc::new(Tree::from_data(&std::fs::read(icon_path)?, &usvg::Options::default())?),
+                    None => icons::atlas().tree("media.svg")
+                        .map_err(|_| anyhow!("Could not find icon for {} or fallback media.svg", icon_name))?,
+                },
+            };
+            ButtonContent::Icon(tree)
         } else {
             ButtonContent::Text(button_config.text.clone().unwrap_or_default())
         };
@@ -358,6 +456,7 @@ pub fn create_default_layout(width: i32, height: i32, has_physical_esc: bool, me
                      width: button_config.width,
                      rounded_corners,
             render_mode: button_config.render_mode.clone(),
+            sprites: None,
         });
         current_x += button_config.width + layout.right.spacing;
     }
@@ -369,10 +468,11 @@ pub fn create_default_layout(width: i32, height: i32, has_physical_esc: bool, me
         height: height as f64,
     };
 
+    build_sprites(&mut buttons, height)?;
     Ok((buttons, dynamic_bounds))
 }
 
-pub fn create_fn_layout(width: i32, _height: i32) -> Result<Vec<Button>> {
+pub fn create_fn_layout(width: i32, height: i32) -> Result<Vec<Button>> {
     let mut buttons = Vec::new();
     let num_buttons = 12;
     let spacing = 10.0;
@@ -387,9 +487,11 @@ pub fn create_fn_layout(width: i32, _height: i32) -> Result<Vec<Button>> {
                      width: button_width,
                      rounded_corners: RoundedCorners::All,
             render_mode: ButtonRenderMode::Mask,
+            sprites: None,
         });
     }
 
+    build_sprites(&mut buttons, height)?;
     Ok(buttons)
 }
 
@@ -415,7 +517,7 @@ pub fn create_volume_slider_layout(width: i32, _height: i32, value: f64) -> Resu
     })
 }
 
-pub fn create_expanded_layout(width: i32, _height: i32) -> Result<Vec<Button>> {
+pub fn create_expanded_layout(width: i32, height: i32) -> Result<Vec<Button>> {
     let mut buttons = Vec::new();
     let mut current_x = 0.0;
     let spacing = 2.0;
@@ -440,17 +542,14 @@ pub fn create_expanded_layout(width: i32, _height: i32) -> Result<Vec<Button>> {
     let button_width = (width as f64 - total_spacing) / total_buttons as f64;
 
     for (icon_name, action, rounded_corners, is_group_ender) in button_definitions {
-        let icon_path = find_resource_path(&format!("icons/{}", icon_name))?;
-        let svg_data = std::fs::read(icon_path)?;
-        let tree = Tree::from_data(&svg_data, &usvg::Options::default())?;
-
         buttons.push(Button {
-            content: ButtonContent::Icon(Arc::new(tree)),
+            content: ButtonContent::Icon(icons::atlas().tree(icon_name)?),
                      action,
                      x: current_x,
                      width: button_width,
                      rounded_corners,
             render_mode: ButtonRenderMode::Mask,
+            sprites: None,
         });
 
         current_x += button_width;
@@ -461,9 +560,17 @@ pub fn create_expanded_layout(width: i32, _height: i32) -> Result<Vec<Button>> {
         }
     }
 
+    build_sprites(&mut buttons, height)?;
     Ok(buttons)
 }
 
+fn build_sprites(buttons: &mut [Button], height: i32) -> Result<()> {
+    for button in buttons {
+        button.build_sprites(height)?;
+    }
+    Ok(())
+}
+
 fn string_to_key(s: &str) -> Key {
     match s {
         "KEY_ESC" => Key::Esc,
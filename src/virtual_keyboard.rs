@@ -26,7 +26,7 @@ pub fn create_virtual_keyboard() -> Result<UInputHandle<File>> {
     })?;
     uinput.dev_create()?;
 
-    println!("[input] Virtual keyboard device created successfully.");
+    log_info!("[input] Virtual keyboard device created successfully.");
     Ok(uinput)
 }
 
@@ -1,16 +1,42 @@
 use anyhow::{anyhow, Result};
 use std::process::Command;
 use std::env;
+use std::thread;
+use std::time::Duration;
+use crate::pulse;
 
-enum AudioBackend {
+#[derive(Clone, Copy)]
+enum AudioTool {
     PipeWire,
     PulseAudio,
 }
 
+enum AudioBackend {
+    // one persistent connection to the sound server; changes are pushed to us
+    Native(pulse::Sender),
+    // falls back to running wpctl or pactl for every request
+    Tool(AudioTool),
+}
+
 pub struct Volume {
     backend: AudioBackend,
+    connection: Option<pulse::Connection>,
+}
+
+// Blocks until the default sink's volume changes.
+pub struct VolumeWatcher {
+    source: WatchSource,
+    last: Option<f64>,
+}
+
+enum WatchSource {
+    Native(pulse::Connection),
+    Polling(AudioTool),
 }
 
+const POLL_INTERVAL: Duration = Duration::from_secs(1);
+const RECONNECT_DELAY: Duration = Duration::from_secs(5);
+
 fn create_command(program: &str) -> Command {
     if let (Ok(sudo_user), Ok(sudo_uid)) = (env::var("SUDO_USER"), env::var("SUDO_UID")) {
         let mut command = Command::new("sudo");
@@ -25,89 +51,168 @@ fn create_command(program: &str) -> Command {
     }
 }
 
-// controlling audio directly from Rust is finnicky, therefore relies on wpctl or pactl.
+// Speaks the PulseAudio protocol (also served by pipewire-pulse) when the server's
+// socket is reachable, and otherwise relies on wpctl or pactl.
 impl Volume {
     pub fn new() -> Result<Self> {
-        let backend = if create_command("wpctl").arg("--version").output().map_or(false, |o| o.status.success()) {
-            println!("[volume] Using PipeWire backend (wpctl)");
-            AudioBackend::PipeWire
+        match pulse::Connection::open() {
+            Ok(connection) => {
+                log_info!("[volume] Using native PulseAudio protocol backend");
+                return Ok(Volume { backend: AudioBackend::Native(connection.sender()), connection: Some(connection) });
+            }
+            Err(e) => log_warn!("[volume] Cannot connect to the sound server ({}), falling back to command line tools", e),
+        }
+
+        let tool = if create_command("wpctl").arg("--version").output().map_or(false, |o| o.status.success()) {
+            log_info!("[volume] Using PipeWire backend (wpctl)");
+            AudioTool::PipeWire
         } else if create_command("pactl").arg("--version").output().map_or(false, |o| o.status.success()) {
-            println!("[volume] Using PulseAudio backend (pactl)");
-            AudioBackend::PulseAudio
+            log_info!("[volume] Using PulseAudio backend (pactl)");
+            AudioTool::PulseAudio
         } else {
             return Err(anyhow!("No suitable audio backend found. Please install 'wpctl' (pipewire-bin) or 'pactl' (pulseaudio)."));
         };
-        Ok(Volume { backend })
+        Ok(Volume { backend: AudioBackend::Tool(tool), connection: None })
+    }
+
+    // Hands the reading side of the connection to a watcher; call once.
+    pub fn watcher(&mut self) -> Result<VolumeWatcher> {
+        let source = match (&self.backend, self.connection.take()) {
+            (AudioBackend::Native(_), Some(connection)) => WatchSource::Native(connection),
+            (AudioBackend::Tool(tool), _) => WatchSource::Polling(*tool),
+            _ => return Err(anyhow!("Volume is already being watched")),
+        };
+        Ok(VolumeWatcher { source, last: None })
     }
 
     pub fn set_volume(&self, value: f64) -> Result<()> {
         let value = value.max(0.0).min(1.5); // overamp max %150
-        let output = match self.backend {
-            AudioBackend::PipeWire => {
-                create_command("wpctl")
-                    .arg("set-volume")
-                    .arg("@DEFAULT_AUDIO_SINK@")
-                    .arg(format!("{:.2}", value))
-                    .output()?
-            }
-            AudioBackend::PulseAudio => {
-                create_command("pactl")
-                    .arg("set-sink-volume")
-                    .arg("@DEFAULT_SINK@")
-                    .arg(format!("{}%", (value * 100.0).round() as u32))
-                    .output()?
-            }
-        };
+        match &self.backend {
+            AudioBackend::Native(sender) => sender.set_default_sink_volume((value * pulse::VOLUME_NORM as f64).round() as u32),
+            AudioBackend::Tool(tool) => set_tool_volume(*tool, value),
+        }
+    }
+}
 
-        if !output.status.success() {
-            return Err(anyhow!(
-                "Failed to set volume: {}",
-                String::from_utf8_lossy(&output.stderr)
-            ));
+fn set_tool_volume(tool: AudioTool, value: f64) -> Result<()> {
+    let output = match tool {
+        AudioTool::PipeWire => {
+            create_command("wpctl")
+                .arg("set-volume")
+                .arg("@DEFAULT_AUDIO_SINK@")
+                .arg(format!("{:.2}", value))
+                .output()?
+        }
+        AudioTool::PulseAudio => {
+            create_command("pactl")
+                .arg("set-sink-volume")
+                .arg("@DEFAULT_SINK@")
+                .arg(format!("{}%", (value * 100.0).round() as u32))
+                .output()?
         }
-        Ok(())
+    };
+
+    if !output.status.success() {
+        return Err(anyhow!(
+            "Failed to set volume: {}",
+            String::from_utf8_lossy(&output.stderr)
+        ));
     }
+    Ok(())
+}
 
-    pub fn get_volume(&self) -> Result<f64> {
-        let output = match self.backend {
-            AudioBackend::PipeWire => {
-                create_command("wpctl")
-                    .arg("get-volume")
-                    .arg("@DEFAULT_AUDIO_SINK@")
-                    .output()?
-            }
-            AudioBackend::PulseAudio => {
-                create_command("pactl")
-                    .arg("get-sink-volume")
-                    .arg("@DEFAULT_SINK@")
-                    .output()?
-            }
-        };
+fn get_tool_volume(tool: AudioTool) -> Result<f64> {
+    let output = match tool {
+        AudioTool::PipeWire => {
+            create_command("wpctl")
+                .arg("get-volume")
+                .arg("@DEFAULT_AUDIO_SINK@")
+                .output()?
+        }
+        AudioTool::PulseAudio => {
+            create_command("pactl")
+                .arg("get-sink-volume")
+                .arg("@DEFAULT_SINK@")
+                .output()?
+        }
+    };
 
-        if !output.status.success() {
-            return Err(anyhow!(
-                "Failed to get volume: {}",
-                String::from_utf8_lossy(&output.stderr)
-            ));
+    if !output.status.success() {
+        return Err(anyhow!(
+            "Failed to get volume: {}",
+            String::from_utf8_lossy(&output.stderr)
+        ));
+    }
+
+    let stdout = String::from_utf8_lossy(&output.stdout);
+    match tool {
+        AudioTool::PipeWire => {
+            stdout.split_whitespace().nth(1)
+                .ok_or_else(|| anyhow!("Failed to parse volume from wpctl output: unexpected format on '{}'", stdout))?
+                .parse::<f64>()
+                .map_err(|e| anyhow!("Failed to parse volume from wpctl output: {} on '{}'", e, stdout))
+        }
+        AudioTool::PulseAudio => {
+            let volume_str = stdout
+                .split('/')
+                .nth(1)
+                .and_then(|s| s.trim().strip_suffix('%'))
+                .ok_or_else(|| anyhow!("Failed to parse volume from pactl output: unexpected format on '{}'", stdout))?;
+            
+            let volume_percent: f64 = volume_str.trim().parse()?;
+            Ok(volume_percent / 100.0)
         }
+    }
+}
 
-        let stdout = String::from_utf8_lossy(&output.stdout);
-        match self.backend {
-            AudioBackend::PipeWire => {
-                stdout.split_whitespace().nth(1)
-                    .ok_or_else(|| anyhow!("Failed to parse volume from wpctl output: unexpected format on '{}'", stdout))?
-                    .parse::<f64>()
-                    .map_err(|e| anyhow!("Failed to parse volume from wpctl output: {} on '{}'", e, stdout))
+impl VolumeWatcher {
+    fn read(&mut self) -> Result<f64> {
+        match &mut self.source {
+            WatchSource::Native(connection) => {
+                // nothing is known yet (or a reconnect lost track), so read right away
+                if self.last.is_some() {
+                    connection.wait_event()?;
+                }
+                Ok(connection.default_sink_volume()? as f64 / pulse::VOLUME_NORM as f64)
+            }
+            WatchSource::Polling(tool) => {
+                if self.last.is_some() {
+                    thread::sleep(POLL_INTERVAL);
+                }
+                get_tool_volume(*tool)
             }
-            AudioBackend::PulseAudio => {
-                let volume_str = stdout
-                    .split('/')
-                    .nth(1)
-                    .and_then(|s| s.trim().strip_suffix('%'))
-                    .ok_or_else(|| anyhow!("Failed to parse volume from pactl output: unexpected format on '{}'", stdout))?;
-                
-                let volume_percent: f64 = volume_str.trim().parse()?;
-                Ok(volume_percent / 100.0)
+        }
+    }
+
+    // The first call returns the current volume straight away.
+    pub fn wait(&mut self) -> Result<f64> {
+        loop {
+            let current = match self.read() {
+                Ok(current) => current,
+                Err(e) => {
+                    match &mut self.source {
+                        // the sound server restarted or went away; keep trying to get it back
+                        WatchSource::Native(connection) => {
+                            log_warn!("[volume] Lost connection to the sound server: {}", e);
+                            thread::sleep(RECONNECT_DELAY);
+                            if let Err(e) = connection.reopen() {
+                                log_warn!("[volume] Reconnect failed: {}", e);
+                            }
+                        }
+                        // wpctl/pactl can fail while the server restarts; ask again later
+                        WatchSource::Polling(_) => {
+                            log_warn!("[volume] Failed to read the volume: {}", e);
+                            thread::sleep(POLL_INTERVAL);
+                        }
+                    }
+                    self.last = None;
+                    continue;
+                }
+            };
+
+            if self.last != Some(current) {
+                self.last = Some(current);
+                return Ok(current);
             }
         }
     }